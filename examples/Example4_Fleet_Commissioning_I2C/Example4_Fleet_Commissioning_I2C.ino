@@ -0,0 +1,254 @@
+/*
+  This example sketch commissions several lightning detectors at once, as you
+  would on a production test jig. Each board has its antenna tuned, its
+  oscillators calibrated and its configuration checked, and then a report is
+  printed for every board. Boards that pass the self test have their tuning
+  capacitor value stored in EEPROM, ready to be given to tuneCap() in the
+  field. On boards without an EEPROM library, like SAMD boards, the values
+  are printed instead. The boards are
+  worked on together rather than one after the other: the antenna frequencies
+  of all boards are measured in the same window, and the oscillators of all
+  boards are calibrated with a single wait. 
+
+  Three boards can share one I-squared-C bus using the address jumpers, give
+  each one its own interrupt pin. 
+
+  By: SparkFun Electronics
+  Date: October, 2026
+  License: This code is public domain but you buy me a beer if you use this and we meet someday (Beerware license).
+*/
+
+#include <SPI.h>
+#include <Wire.h>
+#if defined(__AVR__) || defined(ESP32) || defined(ESP8266)
+#define HAS_EEPROM
+#include <EEPROM.h>
+#endif
+#include "SparkFun_AS3935.h"
+
+#define NUM_BOARDS 3
+#define ANTFREQ 3
+#define DIV_RATIO 128 // Antenna frequency is divided by this on the IRQ pin.
+#define MEASURE_MS 100 // How long the antenna frequency is counted for. 
+#define EEPROM_ADDR 0 // A marker byte then one tuning value per board.
+#define EEPROM_MARKER 0x35
+
+SparkFun_AS3935 board1(0x03);
+SparkFun_AS3935 board2(0x02);
+SparkFun_AS3935 board3(0x01);
+SparkFun_AS3935 *boards[NUM_BOARDS] = { &board1, &board2, &board3 }; 
+
+// Interrupt pins for each board, the antenna frequency is measured on these.
+const int intPins[NUM_BOARDS] = { 4, 5, 6 }; 
+
+// Results for the report.
+bool present[NUM_BOARDS]; 
+bool calibrated[NUM_BOARDS]; 
+bool verified[NUM_BOARDS]; 
+bool selfTest[NUM_BOARDS]; 
+byte bestCap[NUM_BOARDS]; 
+long bestFreq[NUM_BOARDS]; 
+
+void setup()
+{
+  Serial.begin(115200); 
+  Serial.println("AS3935 Franklin Lightning Detector - Fleet Commissioning"); 
+
+  Wire.begin(); // Begin Wire before lightning sensor. 
+
+  // The clock is shared by every board on the bus, so it's negotiated once,
+  // by the first board that answers, and the others are left at that rate.
+  // A board that can't keep up fails its verify and its self test. 
+  uint32_t busSpeed = 0; 
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    pinMode(intPins[i], INPUT); 
+    if( busSpeed == 0 ){
+      present[i] = boards[i]->begin(Wire, 400000); 
+      if( present[i] )
+        busSpeed = boards[i]->linkSpeed(); 
+    }
+    else
+      present[i] = boards[i]->begin(Wire); 
+    bestFreq[i] = 0; 
+    bestCap[i] = 0; 
+  }
+
+  // Every board gets the same profile, verified with one burst read each.
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    if( !present[i] )
+      continue; 
+    boards[i]->resetSettings(); 
+    boards[i]->writeVerify(true); 
+    boards[i]->setIndoorOutdoor(OUTDOOR); 
+    boards[i]->setNoiseLevel(2); 
+    boards[i]->watchdogThreshold(2); 
+    boards[i]->spikeRejection(2); 
+    boards[i]->changeDivRatio(DIV_RATIO); 
+  }
+
+  tuneAntennas(); 
+
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    if( present[i] ){
+      boards[i]->tuneCap(bestCap[i]); 
+      verified[i] = boards[i]->verifyWrites(); 
+    }
+  }
+
+  // Only the boards that are present are calibrated, together.
+  SparkFun_AS3935 *found[NUM_BOARDS]; 
+  bool results[NUM_BOARDS]; 
+  int numFound = 0; 
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    if( present[i] )
+      found[numFound++] = boards[i]; 
+  }
+  SparkFun_AS3935::calibrateOscAll(found, numFound, results); 
+  for( int i = 0, j = 0; i < NUM_BOARDS; i++ )
+    calibrated[i] = present[i] ? results[j++] : false; 
+
+  runSelfTests(); 
+  printReport(); 
+  Serial.print("Bus clock: "); 
+  Serial.println(busSpeed); 
+  storeProfiles(); 
+}
+
+void loop() {
+}
+
+// Tries every tuning capacitor value on all boards at the same time and keeps
+// the one that brings each board's antenna closest to 500kHz. For each value
+// the antenna frequency of every board is counted on its interrupt pin in the
+// same window. 
+void tuneAntennas()
+{
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    if( present[i] )
+      boards[i]->displayOscillator(true, ANTFREQ); 
+  }
+
+  for( int cap = 0; cap <= 120; cap += 8 ){
+    long edges[NUM_BOARDS] = { 0 }; 
+    int last[NUM_BOARDS]; 
+
+    for( int i = 0; i < NUM_BOARDS; i++ ){
+      if( present[i] )
+        boards[i]->tuneCap(cap); 
+      last[i] = digitalRead(intPins[i]); 
+    }
+
+    unsigned long start = millis(); 
+    while( millis() - start < MEASURE_MS ){
+      for( int i = 0; i < NUM_BOARDS; i++ ){
+        int now = digitalRead(intPins[i]); 
+        if( now == HIGH && last[i] == LOW )
+          edges[i]++; 
+        last[i] = now; 
+      }
+    }
+
+    for( int i = 0; i < NUM_BOARDS; i++ ){
+      long freq = edges[i] * (1000 / MEASURE_MS) * DIV_RATIO; 
+      if( labs(freq - 500000) < labs(bestFreq[i] - 500000) ){
+        bestFreq[i] = freq; 
+        bestCap[i] = cap; 
+      }
+    }
+  }
+
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    if( present[i] )
+      boards[i]->displayOscillator(false, ANTFREQ); 
+  }
+}
+
+// With the antenna display off the IRQ pin must idle LOW and the interrupt
+// register must read back a known event type, as must the configuration
+// written earlier. Together with the oscillator calibration this is the
+// board's self test. 
+void runSelfTests()
+{
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    selfTest[i] = false; 
+    if( !present[i] )
+      continue; 
+    uint8_t intVal = boards[i]->readInterruptReg(); 
+    bool irqOk = (digitalRead(intPins[i]) == LOW) && 
+      ((intVal == 0) || (intVal == NOISE_TO_HIGH) || (intVal == DISTURBER_DETECT) || (intVal == LIGHTNING)); 
+    bool configOk = (boards[i]->readIndoorOutdoor() == OUTDOOR) && (boards[i]->readNoiseLevel() == 2); 
+    selfTest[i] = irqOk && configOk && verified[i] && calibrated[i]; 
+  }
+}
+
+#ifdef HAS_EEPROM
+// Writes a byte only if it changed, to spare the EEPROM. 
+void storeByte(int _addr, uint8_t _value)
+{
+  if( EEPROM.read(_addr) != _value )
+    EEPROM.write(_addr, _value); 
+}
+#endif
+
+// Stores the tuning capacitor value of every board that passed. A board that
+// failed gets 0xFF so that it isn't mistaken for a tuned one. Use
+// EEPROM.read(EEPROM_ADDR + 1 + board) in the field to get a value back. 
+void storeProfiles()
+{
+#if defined(ESP32) || defined(ESP8266)
+  // The EEPROM is emulated in flash here, it has to be given a size and
+  // committed. 
+  EEPROM.begin(EEPROM_ADDR + 1 + NUM_BOARDS); 
+#endif
+#ifdef HAS_EEPROM
+  storeByte(EEPROM_ADDR, EEPROM_MARKER); 
+#else
+  Serial.println("No EEPROM on this board, tuning values (0xFF if failed):"); 
+#endif
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    bool tuned = labs(bestFreq[i] - 500000) <= 17500; 
+    uint8_t value = (selfTest[i] && tuned) ? bestCap[i] : 0xFF; 
+#ifdef HAS_EEPROM
+    storeByte(EEPROM_ADDR + 1 + i, value); 
+#else
+    Serial.print("Board "); 
+    Serial.print(i + 1); 
+    Serial.print(": "); 
+    Serial.println(value); 
+#endif
+  }
+#if defined(ESP32) || defined(ESP8266)
+  EEPROM.commit(); 
+#endif
+#ifdef HAS_EEPROM
+  Serial.println("Tuning values of passing boards stored in EEPROM."); 
+#endif
+}
+
+
+// Prints one line per board. 
+void printReport()
+{
+  Serial.println("\nBoard, Present, Antenna Hz, Tune Cap pF, Verified, Calibrated, Self Test, Result"); 
+  for( int i = 0; i < NUM_BOARDS; i++ ){
+    // Within 3.5 percent of 500kHz, see the datasheet. 
+    bool tuned = labs(bestFreq[i] - 500000) <= 17500; 
+    bool pass = present[i] && tuned && selfTest[i]; 
+
+    Serial.print(i + 1); 
+    Serial.print(", "); 
+    Serial.print(present[i] ? "YES" : "NO"); 
+    Serial.print(", "); 
+    Serial.print(bestFreq[i]); 
+    Serial.print(", "); 
+    Serial.print(bestCap[i]); 
+    Serial.print(", "); 
+    Serial.print(verified[i] ? "YES" : "NO"); 
+    Serial.print(", "); 
+    Serial.print(calibrated[i] ? "YES" : "NO"); 
+    Serial.print(", "); 
+    Serial.print(selfTest[i] ? "YES" : "NO"); 
+    Serial.print(", "); 
+    Serial.println(pass ? "PASS" : "FAIL"); 
+  }
+}
@@ -0,0 +1,187 @@
+/*
+  This example sketch benchmarks the library on your board and bus. Every
+  call below is run a number of times and, for each, the time it takes on
+  the processor, the register transactions it makes and the time the bus is
+  busy with them are measured. The throughput of an event pipeline is then
+  measured too, and the servicing of an event, from reading the interrupt
+  register through the pipeline, is checked for heap allocations. The
+  results are printed as one line of JSON, so that a run
+  can be saved and compared with a later one:
+
+    python3 extras/as3935_bench_compare.py before.json after.json
+
+  which lists the calls that got slower by more than run to run noise, and
+  fails if the servicing now allocates. 
+
+  By: SparkFun Electronics
+  Date: October, 2026
+  License: This code is public domain but you buy me a beer if you use this and we meet someday (Beerware license).
+*/
+
+#include <SPI.h>
+#include <Wire.h>
+#include "SparkFun_AS3935.h"
+#include "SparkFun_AS3935_Pipeline.h"
+#include "SparkFun_AS3935_HeapGuard.h"
+
+int spiCS = 10; //SPI chip select pin
+#define RUNS 50 // Times each call is run.
+#define PIPELINE_EVENTS 1000 // Events passed through the pipeline.
+
+SparkFun_AS3935 lightning;
+
+// Stages for the pipeline benchmark, doing about as much work as simple
+// real ones would.
+struct DropDisturbers {
+  bool process(lightningEvent &_event) { return _event.type != DISTURBER_DETECT; }
+};
+
+struct NearestStrike {
+  uint8_t nearest = 0xFF; 
+  bool process(lightningEvent &_event)
+  {
+    if( _event.distance < nearest )
+      nearest = _event.distance; 
+    return true; 
+  }
+};
+
+struct EnergyTotal {
+  uint32_t total = 0; 
+  bool process(lightningEvent &_event) { total += _event.energy; return true; }
+};
+
+AS3935Pipeline<DropDisturbers, NearestStrike, EnergyTotal> pipeline; 
+
+bool first = true; 
+
+void setup()
+{
+  Serial.begin(115200); 
+  SPI.begin(); 
+
+  if( !lightning.beginSPI(spiCS, 2000000) ){ 
+    Serial.println ("Lightning Detector did not start up, freezing!"); 
+    while(1); 
+  }
+
+  Serial.print("{\"library\":\"SparkFun AS3935\",\"transport\":\"SPI\",\"runs\":"); 
+  Serial.print(RUNS); 
+  Serial.print(",\"results\":["); 
+
+  bench("readInterruptRegNow", [](){ lightning.readInterruptRegNow(); }); 
+  bench("readNoiseLevel", [](){ lightning.readNoiseLevel(); }); 
+  bench("setNoiseLevel", [](){ lightning.setNoiseLevel(2); }); 
+  bench("lightningEnergy", [](){ lightning.lightningEnergy(); }); 
+  bench("distanceToStorm", [](){ lightning.distanceToStorm(); }); 
+  bench("pollEvent", [](){ lightningEvent event; lightning.pollEvent(event); }); 
+  bench("applyPreset", [](){ lightning.applyPreset(PRESET_DEFAULT); }); 
+  // applyPreset() alone is measured above, so the difference is the verify.
+  lightning.writeVerify(true); 
+  bench("verifyWrites", [](){ lightning.applyPreset(PRESET_DEFAULT); lightning.verifyWrites(); }); 
+  lightning.writeVerify(false); 
+
+  Serial.print("],"); 
+  benchPipeline(); 
+  Serial.print(","); 
+  checkHeap(); 
+  Serial.println("}"); 
+}
+
+void loop()
+{
+}
+
+// Runs the call RUNS times and prints its mean and standard deviation in
+// microseconds, along with the transactions and bus time per call.
+void bench(const char *name, void (*call)())
+{
+  float mean = 0; 
+  float squares = 0; 
+  uint32_t transactions = lightning.transactionCount(); 
+  uint32_t busTime = lightning.busTime(); 
+
+  for( int i = 1; i <= RUNS; i++ ){
+    uint32_t start = micros(); 
+    call(); 
+    float took = micros() - start; 
+    // Welford's method, so that nothing has to be kept per run.
+    float delta = took - mean; 
+    mean += delta / i; 
+    squares += delta * (took - mean); 
+  }
+
+  transactions = lightning.transactionCount() - transactions; 
+  busTime = lightning.busTime() - busTime; 
+
+  if( !first )
+    Serial.print(","); 
+  first = false; 
+  Serial.print("{\"name\":\""); 
+  Serial.print(name); 
+  Serial.print("\",\"n\":"); 
+  Serial.print(RUNS); 
+  Serial.print(",\"mean_us\":"); 
+  Serial.print(mean, 2); 
+  Serial.print(",\"stddev_us\":"); 
+  Serial.print(sqrt(squares / (RUNS - 1)), 2); 
+  Serial.print(",\"transactions\":"); 
+  Serial.print((float)transactions / RUNS, 2); 
+  Serial.print(",\"bus_us\":"); 
+  Serial.print((float)busTime / RUNS, 2); 
+  Serial.print("}"); 
+}
+
+// Passes made up events through the pipeline and prints how many it handles
+// a second.
+void benchPipeline()
+{
+  lightningEvent event; 
+  event.timestamp = millis(); 
+  pipeline.clearStats(); 
+
+  uint32_t start = micros(); 
+  for( uint16_t i = 0; i < PIPELINE_EVENTS; i++ ){
+    event.type = (i % 4 == 0) ? DISTURBER_DETECT : LIGHTNING; 
+    event.distance = i % 40; 
+    event.energy = i; 
+    event.sequence = i; 
+    pipeline.process(event); 
+  }
+  uint32_t took = micros() - start; 
+
+  Serial.print("\"pipeline\":{\"events\":"); 
+  Serial.print(PIPELINE_EVENTS); 
+  Serial.print(",\"time_us\":"); 
+  Serial.print(took); 
+  Serial.print(",\"events_per_s\":"); 
+  Serial.print(PIPELINE_EVENTS * 1000000.0 / took, 1); 
+  Serial.print("}"); 
+}
+
+// Services events RUNS times, the way loop() would, and prints how many
+// allocations were made. 
+void checkHeap()
+{
+  lightningEvent event; 
+  AS3935HeapGuard guard; 
+
+  for( int i = 0; i < RUNS; i++ ){
+    lightning.readInterruptRegNow(); 
+    if( !lightning.pollEvent(event) ){
+      event.type = LIGHTNING; // No storm nearby, make one up. 
+      event.distance = i; 
+      event.energy = i; 
+      event.sequence = i; 
+    }
+    pipeline.process(event); 
+  }
+
+  Serial.print("\"heap\":{\"checked\":true,\"allocations\":"); 
+  Serial.print(guard.allocations()); 
+  Serial.print(",\"malloc_checked\":"); 
+  Serial.print(AS3935HeapGuard::checksMalloc() ? "true" : "false"); 
+  Serial.print(",\"allocated\":"); 
+  Serial.print(guard.allocated() ? "true" : "false"); 
+  Serial.print("}"); 
+}
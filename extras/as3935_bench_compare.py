@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Compares two runs of the Example5_Benchmark sketches.
+
+Save the JSON line each run prints to a file, then:
+
+    python3 as3935_bench_compare.py before.json after.json
+
+Every call is listed with its time before and after. A call is marked as a
+regression when it got slower by more than --threshold percent and Welch's
+t-test says the difference is larger than run to run noise, or when it
+makes more bus transactions than before. A drop in pipeline throughput of
+more than --threshold percent is a regression too, as is any heap
+allocation while servicing events, on boards that can check for it. The
+exit status is 1 if there were any, so the tool can gate a build.
+"""
+
+import argparse
+import json
+import math
+import sys
+
+# Two sided 95% critical values of Student's t, by degrees of freedom.
+T_CRITICAL = [
+    (1, 12.71), (2, 4.30), (3, 3.18), (4, 2.78), (5, 2.57), (6, 2.45),
+    (7, 2.36), (8, 2.31), (9, 2.26), (10, 2.23), (15, 2.13), (20, 2.09),
+    (30, 2.04), (60, 2.00), (120, 1.98),
+]
+
+
+def t_critical(df):
+    """Returns the critical value for df degrees of freedom, erring on the
+    side of the larger value between the table entries: the one for the
+    largest tabled df that isn't above df."""
+    critical = T_CRITICAL[0][1]
+    for entry_df, value in T_CRITICAL:
+        if entry_df > df:
+            break
+        critical = value
+    return critical
+
+
+def welch(before, after):
+    """Returns Welch's t statistic and degrees of freedom for the change in
+    mean from before to after."""
+    var_before = before["stddev_us"] ** 2 / before["n"]
+    var_after = after["stddev_us"] ** 2 / after["n"]
+    spread = var_before + var_after
+    if spread == 0:
+        return (math.inf if after["mean_us"] != before["mean_us"] else 0.0), 1
+    t = (after["mean_us"] - before["mean_us"]) / math.sqrt(spread)
+    df = spread ** 2 / (
+        var_before ** 2 / max(before["n"] - 1, 1)
+        + var_after ** 2 / max(after["n"] - 1, 1)
+    )
+    return t, max(int(df), 1)
+
+
+def load(path):
+    """Reads a saved run. Lines that aren't the JSON result are skipped, so
+    a whole serial capture can be given."""
+    with open(path) as capture:
+        for line in capture:
+            line = line.strip()
+            if line.startswith("{") and '"results"' in line:
+                return json.loads(line)
+    sys.exit("%s: no benchmark results found" % path)
+
+
+def compare(before, after, threshold):
+    regressions = 0
+    old = {result["name"]: result for result in before["results"]}
+
+    print("%-22s %10s %10s %8s %8s  %s" % ("call", "before us", "after us", "change", "t", ""))
+    for result in after["results"]:
+        name = result["name"]
+        if name not in old:
+            print("%-22s %10s %10.2f %8s %8s  new" % (name, "-", result["mean_us"], "-", "-"))
+            continue
+
+        base = old[name]
+        change = 100.0 * (result["mean_us"] - base["mean_us"]) / base["mean_us"] if base["mean_us"] else 0.0
+        t, df = welch(base, result)
+        notes = []
+        if change > threshold and t > t_critical(df):
+            notes.append("REGRESSION")
+        elif change < -threshold and -t > t_critical(df):
+            notes.append("faster")
+        if result["transactions"] > base["transactions"]:
+            notes.append("REGRESSION: %.2f transactions, was %.2f" % (result["transactions"], base["transactions"]))
+        if any(note.startswith("REGRESSION") for note in notes):
+            regressions += 1
+        print("%-22s %10.2f %10.2f %7.1f%% %8.2f  %s" % (
+            name, base["mean_us"], result["mean_us"], change, t, ", ".join(notes)))
+
+    if "pipeline" in before and "pipeline" in after:
+        rate_before = before["pipeline"]["events_per_s"]
+        rate_after = after["pipeline"]["events_per_s"]
+        change = 100.0 * (rate_after - rate_before) / rate_before if rate_before else 0.0
+        note = ""
+        if change < -threshold:
+            note = "REGRESSION"
+            regressions += 1
+        print("%-22s %10.1f %10.1f %7.1f%% %8s  %s" % (
+            "pipeline events/s", rate_before, rate_after, change, "-", note))
+
+    heap = after.get("heap", {})
+    if heap.get("checked"):
+        if heap.get("allocated"):
+            print("event servicing allocated heap memory (%d new calls)  REGRESSION"
+                  % heap.get("allocations", 0))
+            regressions += 1
+        else:
+            print("event servicing made no heap allocations")
+    else:
+        print("heap allocations not checked on this board")
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("before")
+    parser.add_argument("after")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="smallest change in percent reported (default 5)")
+    args = parser.parse_args()
+
+    before = load(args.before)
+    after = load(args.after)
+    if before.get("transport") != after.get("transport"):
+        print("warning: comparing %s with %s" % (before.get("transport"), after.get("transport")))
+
+    regressions = compare(before, after, args.threshold)
+    print("%d regression%s" % (regressions, "" if regressions == 1 else "s"))
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Converts the trace printed by as3935TraceDump() into a Chrome trace.
+
+Capture the sketch's serial output to a file, then:
+
+    python3 as3935_trace_to_chrome.py capture.txt > trace.json
+
+and open trace.json in chrome://tracing or https://ui.perfetto.dev. Lines
+that aren't trace records are ignored, so the capture can hold other output.
+"""
+
+import json
+import sys
+
+TRACE_BEGIN = 0x40
+TRACE_END = 0x80
+
+NAMES = {
+    0x01: "IRQ edge",
+    0x02: "IRQ wait",
+    0x03: "read",
+    0x04: "write",
+    0x05: "stage",
+}
+
+REGISTERS = {
+    0x00: "AFE_GAIN",
+    0x01: "THRESHOLD",
+    0x02: "LIGHTNING_REG",
+    0x03: "INT_MASK_ANT",
+    0x04: "ENERGY_LIGHT_LSB",
+    0x05: "ENERGY_LIGHT_MSB",
+    0x06: "ENERGY_LIGHT_MMSB",
+    0x07: "DISTANCE",
+    0x08: "FREQ_DISP_IRQ",
+    0x3A: "CALIB_TRCO",
+    0x3B: "CALIB_SRCO",
+    0x3C: "RESET_LIGHT",
+    0x3D: "CALIB_RCO",
+}
+
+
+def records(lines):
+    """Yields (time, event, arg) for every trace line, with micros()
+    wrap-arounds unwound so that time keeps increasing."""
+    offset = 0
+    last = None
+    for line in lines:
+        fields = line.split()
+        if len(fields) != 4 or fields[0] != "AS3935T":
+            continue
+        try:
+            time, event, arg = (int(field, 16) for field in fields[1:])
+        except ValueError:
+            continue
+        if last is not None and time < last:
+            offset += 1 << 32
+        last = time
+        yield time + offset, event, arg
+
+
+def convert(lines):
+    events = []
+    for time, event, arg in records(lines):
+        kind = event & ~(TRACE_BEGIN | TRACE_END)
+        name = NAMES.get(kind, "event 0x%02X" % kind)
+        args = {}
+        if kind in (0x03, 0x04):
+            register = REGISTERS.get(arg, "0x%02X" % arg)
+            name = "%s %s" % (name, register)
+            args["register"] = register
+        elif kind == 0x05:
+            name = "%s %d" % (name, arg)
+            args["index"] = arg
+
+        if event & TRACE_BEGIN:
+            phase = "B"
+        elif event & TRACE_END:
+            phase = "E"
+        else:
+            phase = "i"
+
+        record = {"name": name, "ph": phase, "ts": time, "pid": 1, "tid": 1}
+        if phase == "i":
+            record["s"] = "t"
+        if args:
+            record["args"] = args
+        events.append(record)
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1]) as capture:
+            trace = convert(capture)
+    else:
+        trace = convert(sys.stdin)
+    json.dump(trace, sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -11,33 +11,79 @@
 
 #include "SparkFun_AS3935.h"
 
+// Register images for the presets in SF_AS3935_PRESETS, kept in program
+// memory. Each row is REG0x00, REG0x01 and REG0x02 followed by the mask
+// disturber bit of REG0x03. 
+static constexpr uint8_t presetTable[PRESET_COUNT][4] PROGMEM = {
+  // Gain        NF/WDTH  CL/MIN/SREJ  Mask
+  { INDOOR << 1,  0x22,    0xC2,        0 },  // PRESET_DEFAULT
+  { INDOOR << 1,  0x11,    0xC1,        0 },  // PRESET_INDOOR_SENSITIVE
+  { INDOOR << 1,  0x44,    0xC4,        1 },  // PRESET_INDOOR_NOISY
+  { OUTDOOR << 1, 0x22,    0xC2,        0 },  // PRESET_OUTDOOR
+  { OUTDOOR << 1, 0x11,    0xC1,        0 },  // PRESET_OUTDOOR_SENSITIVE
+  { OUTDOOR << 1, 0x55,    0xD5,        1 }   // PRESET_OUTDOOR_INDUSTRIAL
+}; 
+
+// Lightning thresholds that load shedding steps through. 
+static const uint8_t shedStrikes[] = { 1, 5, 9, 16 }; 
+
+// Clock rates that link fallback steps through, fastest first. 500kHz is
+// left out of the SPI steps as it's the antenna's resonance frequency. 
+static const uint32_t spiSteps[] = { 2000000, 1000000, 250000, 100000 }; 
+static const uint32_t i2cSteps[] = { 1000000, 400000, 100000, 50000 }; 
+#define LINK_STEPS      4
+#define LINK_WINDOW     100 // Transactions per link quality window.
+#define LINK_MAX_ERRORS 5   // Errors in a window that cause a step down.
+#define LINK_CLEAN_WINDOWS 10 // Error free windows before a step up. 
+#define LINK_PROBE_WINDOW 10 // Probes per window on SPI, which only probes can check.
+#define LINK_PROBE_MAX_ERRORS 2 
+
 // Default constructor, to be used with SPI
-SparkFun_AS3935::SparkFun_AS3935() { }
+SparkFun_AS3935::SparkFun_AS3935() { _setDefaults(); }
 
 // Another constructor with I2C but receives address from user.  
-SparkFun_AS3935::SparkFun_AS3935( i2cAddress address ) { _address = address; }
+SparkFun_AS3935::SparkFun_AS3935( i2cAddress address ) { _address = address; _setDefaults(); }
 
-bool SparkFun_AS3935::begin( TwoWire &wirePort )
+bool SparkFun_AS3935::begin( TwoWire &wirePort, uint32_t i2cSpeed )
 {
   // Startup time requires 2ms for the LCO and 2ms more for the RC oscillators
   // which occurs only after the LCO settles. See "Timing" under "Electrical
   // Characteristics" in the datasheet.  
   delay(4); 
   _i2cPort = &wirePort;
+  _softI2c = false; 
+  _shadowValid = 0; 
+  _lastProbe = millis() - _probeMs; // First checkConnection() probes.
+  // The clock isn't touched unless asked for, and then its rate isn't known
+  // so link fallback can't run. 
+  _linkCeiling = 0; 
+  _linkSpeed = 0; 
   //  _i2cPort->begin(); A call to Wire.begin should occur in sketch 
   //  to avoid multiple begins with other sketches.
 
   // A return of 0 indicates success, else an error occurred. 
   _i2cPort->beginTransmission(_address);
   uint8_t _ret = _i2cPort->endTransmission();
-  if(!_ret)
-    return true;
-  else
+  if(_ret)
     return false; 
+
+  if( i2cSpeed > 100000 ) {
+    _linkCeiling = 100000; 
+    _negotiateClock(i2cSpeed); 
+  }
+  else if( i2cSpeed != 0 ) {
+    _linkCeiling = i2cSpeed; 
+    _setLinkSpeed(i2cSpeed); 
+  }
+
+  return true; 
 }
 
 bool SparkFun_AS3935::beginSPI(uint8_t user_CSPin, uint32_t spiPortSpeed, SPIClass &spiPort) 
 {
+  if( spiPortSpeed == 0 ) // No clock rate to run at. 
+    return false; 
+
   // Startup time requires 2ms for the LCO and 2ms more for the RC oscillators
   // which occurs only after the LCO settles. See "Timing" under "Electrical
   // Characteristics" in the datasheet.  
@@ -45,20 +91,99 @@ bool SparkFun_AS3935::beginSPI(uint8_t user_CSPin, uint32_t spiPortSpeed, SPICla
   // I'll be using this as my indicator that SPI is to be used and not I2C.   
   _i2cPort = NULL; 
   _spiPort = &spiPort; 
+  _softSpi = false; 
+  _softI2c = false; 
+  _shadowValid = 0; 
+  _lastProbe = millis() - _probeMs; // First checkConnection() probes.
   _spiPortSpeed = spiPortSpeed; // Make sure it's not 500kHz or it will cause feedback with antekknna.
   _cs = user_CSPin;
   pinMode(_cs, OUTPUT); 
   digitalWrite(_cs, HIGH);// Deselect the Lightning Detector. 
 
-  // Bit order is different for ESP32
-#ifdef ESP32 
-mySpiSettings = SPISettings(spiPortSpeed, SPI_MSBFIRST, SPI_MODE1);  
-#else
-mySpiSettings = SPISettings(spiPortSpeed, MSBFIRST, SPI_MODE1);  
+  _linkCeiling = spiPortSpeed; 
+  _setLinkSpeed(spiPortSpeed); 
+
+  return true; 
+}
+// Bit-banged SPI begin, for boards where the sensor isn't wired to a hardware
+// SPI peripheral. Transfers are SPI mode 1, MSB first. At 1MHz and above no
+// delay is added between clock edges and the rate is set by the processor. 
+bool SparkFun_AS3935::beginSoftSPI(uint8_t user_CSPin, uint8_t sckPin, uint8_t mosiPin, uint8_t misoPin, uint32_t spiPortSpeed)
+{
+  if( spiPortSpeed == 0 ) // The clock's half period is worked out from it.
+    return false; 
+
+  // Startup time requires 2ms for the LCO and 2ms more for the RC oscillators
+  // which occurs only after the LCO settles.
+  delay(4);
+  _i2cPort = NULL; 
+  _spiPort = NULL; 
+  _softSpi = true; 
+  _softI2c = false; 
+  _shadowValid = 0; 
+  _lastProbe = millis() - _probeMs; // First checkConnection() probes.
+  _cs = user_CSPin;
+  _softPin[SOFT_CS] = user_CSPin; 
+  _softPin[SOFT_SCK] = sckPin; 
+  _softPin[SOFT_MOSI] = mosiPin; 
+  _softPin[SOFT_MISO] = misoPin; 
+
+  for( uint8_t i = SOFT_CS; i <= SOFT_MOSI; i++ ) {
+    pinMode(_softPin[i], OUTPUT); 
+#ifdef AS3935_FAST_IO
+    _softOut[i] = portOutputRegister(digitalPinToPort(_softPin[i])); 
+    _softMask[i] = digitalPinToBitMask(_softPin[i]); 
 #endif
+  }
+  pinMode(misoPin, INPUT); 
+#ifdef AS3935_FAST_IO
+  _softIn = portInputRegister(digitalPinToPort(misoPin)); 
+  _softInMask = digitalPinToBitMask(misoPin); 
+#endif
+
+  _fastWrite(SOFT_CS, HIGH); // Deselect the Lightning Detector. 
+  _fastWrite(SOFT_SCK, LOW); // Mode 1 clock idles LOW. 
+
+  _linkCeiling = spiPortSpeed; 
+  _setLinkSpeed(spiPortSpeed); 
 
   return true; 
 }
+
+// Software I-squared-C begin. Every phase of a transaction, including waiting
+// out clock stretching, gives up after timeoutUs so that a locked bus fails
+// the transaction instead of hanging the sketch. The board's pull up
+// resistors are needed on SDA and SCL. 
+bool SparkFun_AS3935::beginSoftI2C(uint8_t sdaPin, uint8_t sclPin, uint32_t i2cSpeed, uint16_t timeoutUs)
+{
+  if( i2cSpeed == 0 ) // The clock's half period is worked out from it.
+    return false; 
+
+  // Startup time requires 2ms for the LCO and 2ms more for the RC oscillators
+  // which occurs only after the LCO settles.
+  delay(4);
+  _i2cPort = NULL; 
+  _spiPort = NULL; 
+  _softSpi = false; 
+  _softI2c = true; 
+  _shadowValid = 0; 
+  _lastProbe = millis() - _probeMs; // First checkConnection() probes.
+  _sda = sdaPin; 
+  _scl = sclPin; 
+  _swTimeoutUs = timeoutUs; 
+
+  // Both lines released, the pins are only ever driven LOW. 
+  digitalWrite(_sda, LOW); 
+  digitalWrite(_scl, LOW); 
+  pinMode(_sda, INPUT); 
+  pinMode(_scl, INPUT); 
+
+  _linkCeiling = i2cSpeed; 
+  _setLinkSpeed(i2cSpeed); 
+
+  return _probe(); 
+}
+
 // REG0x00, bit[0], manufacturer default: 0. 
 // The product consumes 1-2uA while powered down. If the board is powered down 
 // the the TRCO will need to be recalibrated: REG0x08[5] = 1, wait 2 ms, REG0x08[5] = 0.
@@ -101,12 +226,90 @@ void SparkFun_AS3935::setIndoorOutdoor( uint8_t _setting )
 }
 
 // REG0x00, bits [5:1], manufacturer default: 10010 (INDOOR). 
-// This function returns the indoor/outdoor settting. 
-uint8_t SparkFun_AS3935::readIndoorOutdoor(){
+// This function sets the full five bit AFE gain (0-31) rather than just
+// the INDOOR and OUTDOOR presets. Higher values are more sensitive. 
+void SparkFun_AS3935::setGain( uint8_t _gain )
+{
+  if( _gain > GAIN_MAX )
+    return;
 
-  uint8_t regVal = _readRegister(AFE_GAIN); 
-  return ((regVal &= ~GAIN_MASK) >> 1); 
+  _writeRegister(AFE_GAIN, GAIN_MASK, _gain, 1); 
+}
 
+// The auto ranging gain controller steps the AFE gain one value at a time
+// between these limits. It steps down when a window sees any noise (INT_NH),
+// or more disturbers than _disturbLimit and no lightning, and steps up when
+// a window sees no disturbers or noise at all. Disturbers alone don't lower
+// the gain while lightning is still being detected. 
+void SparkFun_AS3935::autoGainLimits( uint8_t _minGain, uint8_t _maxGain, uint8_t _disturbLimit )
+{
+  if( (_minGain > _maxGain) || (_maxGain > GAIN_MAX) )
+    return; 
+
+  _agMinGain = _minGain; 
+  _agMaxGain = _maxGain; 
+  _agDisturbLimit = _disturbLimit; 
+}
+
+// Sets the length of the window that the auto ranging gain controller
+// counts events over before deciding on a gain step, default is one minute.
+void SparkFun_AS3935::autoGainWindow( uint32_t _windowMs )
+{
+  if( _windowMs == 0 )
+    return; 
+
+  _agWindowMs = _windowMs; 
+}
+
+// Give this function the value returned by readInterruptReg() after every
+// event, and call it with zero periodically so that quiet windows are
+// also seen. Returns the AFE gain that is currently set. Each step is a
+// single write since REG0x00 is held in the shadow register. 
+uint8_t SparkFun_AS3935::autoRangeGain( uint8_t _intVal )
+{
+  uint8_t regVal = 0; 
+  bool known = _currentRegister(AFE_GAIN, regVal); 
+  uint8_t gain = (regVal & ~GAIN_MASK) >> 1; 
+
+  if( (_intVal == NOISE_TO_HIGH) && (_agNoise < 0xFF) )
+    _agNoise++; 
+  else if( (_intVal == DISTURBER_DETECT) && (_agDisturber < 0xFF) )
+    _agDisturber++; 
+  else if( (_intVal == LIGHTNING) && (_agLightning < 0xFF) )
+    _agLightning++; 
+
+  // A step is built on the current gain, so none is taken without it. 
+  if( ((millis() - _agWindowStart) < _agWindowMs) || !busAvailable() || !known )
+    return gain; 
+
+  uint8_t newGain = gain;
+  // Noise, or too many disturbers with no lightning getting through them,
+  // give up some sensitivity.
+  if( (_agNoise > 0) || ((_agDisturber > _agDisturbLimit) && (_agLightning == 0)) ) {
+    if( newGain > _agMinGain ) 
+      newGain--; 
+  }
+  // A clean window, there's sensitivity left unused. 
+  else if( _agDisturber == 0 ) {
+    if( newGain < _agMaxGain ) 
+      newGain++; 
+  }
+
+  // Gain may have been set by hand outside of the limits.
+  if( newGain < _agMinGain )
+    newGain = _agMinGain; 
+  if( newGain > _agMaxGain )
+    newGain = _agMaxGain; 
+
+  if( newGain != gain )
+    setGain(newGain); 
+
+  _agWindowStart = millis(); 
+  _agNoise = 0; 
+  _agDisturber = 0; 
+  _agLightning = 0; 
+
+  return newGain; 
 }
 
 // REG0x01, bits[3:0], manufacturer default: 0010 (2). 
@@ -119,15 +322,6 @@ void SparkFun_AS3935::watchdogThreshold( uint8_t _sensitivity )
   _writeRegister(THRESHOLD, THRESH_MASK, _sensitivity, 0);
 }
 
-// REG0x01, bits[3:0], manufacturer default: 0010 (2). 
-// This function returns the threshold for events that trigger the 
-// IRQ Pin.  
-uint8_t SparkFun_AS3935::readWatchdogThreshold(){
-
-  uint8_t regVal = _readRegister(THRESHOLD);
-  return (regVal &= (~THRESH_MASK));
-}
-
 // REG0x01, bits [6:4], manufacturer default: 010 (2).
 // The noise floor level is compared to a known reference voltage. If this
 // level is exceeded the chip will issue an interrupt to the IRQ pin,
@@ -141,13 +335,45 @@ void SparkFun_AS3935::setNoiseLevel( uint8_t _floor )
   _writeRegister(THRESHOLD, NOISE_FLOOR_MASK, _floor, 4); 
 }
 
-// REG0x01, bits [6:4], manufacturer default: 010 (2).
-// This function will return the set noise level threshold: default is 2.
-uint8_t SparkFun_AS3935::readNoiseLevel(){
-
-  uint8_t regVal = _readRegister(THRESHOLD);
-  return (regVal & ~NOISE_FLOOR_MASK) >> 4;
+// Finds the lowest noise floor level (1-7) that doesn't raise INT_NH, with a
+// binary search so that at most three levels are tried. Each level is watched
+// for _dwellMs and given up on as soon as INT_NH shows. The noise level that
+// was set before is put back afterwards. Returns zero if even level 7 is too
+// noisy. Reading the interrupt register here also clears any lightning or
+// disturber event that arrives during the measurement, it's read through
+// _readInterrupt() so the loss is still counted by the sequence numbers. 
+uint8_t SparkFun_AS3935::measureNoiseFloor( uint16_t _dwellMs )
+{
+  uint8_t regVal; 
+  if( !_currentRegister(THRESHOLD, regVal) )
+    return 0; 
+  uint8_t oldLevel = (regVal & ~NOISE_FLOOR_MASK) >> 4; 
+  uint8_t low = 1; 
+  uint8_t high = 7; 
+  uint8_t quietest = 0; 
+
+  while( low <= high ) {
+    uint8_t level = (low + high) / 2; 
+    setNoiseLevel(level); 
+
+    bool noisy = false; 
+    uint32_t start = millis(); 
+    do {
+      delay(10); 
+      if( busAvailable() ) // A survey can wait for the bus. 
+        noisy = _readInterrupt() & NOISE_TO_HIGH; 
+    } while( !noisy && ((millis() - start) < _dwellMs) ); 
+
+    if( noisy ) 
+      low = level + 1; 
+    else {
+      quietest = level; 
+      high = level - 1; 
+    }
+  }
 
+  _writeRegister(THRESHOLD, NOISE_FLOOR_MASK, oldLevel, 4); 
+  return quietest; 
 }
 
 // REG0x02, bits [3:0], manufacturer default: 0010 (2).
@@ -163,17 +389,6 @@ void SparkFun_AS3935::spikeRejection( uint8_t _spSensitivity )
   _writeRegister(LIGHTNING_REG, SPIKE_MASK, _spSensitivity, 0); 
 }
 
-// REG0x02, bits [3:0], manufacturer default: 0010 (2).
-// This function returns the value of the spike rejection register. This value
-// helps to differentiate between events and acutal lightning, by analyzing the 
-// shape of the spike during  chip's signal validation routine. 
-// Increasing this value increases robustness at the cost of sensitivity to distant events. 
-uint8_t SparkFun_AS3935::readSpikeRejection(){
-
-  uint8_t regVal = _readRegister(LIGHTNING_REG);
-  return (regVal &= ~SPIKE_MASK);
-
-}
 // REG0x02, bits [5:4], manufacturer default: 0 (single lightning strike).
 // The number of lightning events before IRQ is set high. 15 minutes is The 
 // window of time before the number of detected lightning events is reset. 
@@ -197,27 +412,80 @@ void SparkFun_AS3935::lightningThreshold( uint8_t _strikes )
   _writeRegister(LIGHTNING_REG, LIGHT_MASK, bits, 4); 
 }
 
-// REG0x02, bits [5:4], manufacturer default: 0 (single lightning strike).
-// This function will return the number of lightning strikes must strike within
-// a 15 minute window before it triggers an event on the IRQ pin. Default is 1. 
-uint8_t SparkFun_AS3935::readLightningThreshold(){
-
-  uint8_t regVal = _readRegister(LIGHTNING_REG);
-
-  regVal &= ~LIGHT_MASK;
-  regVal >>= 4; // Front of the line. 
-
-  if(regVal == 0)
-    return 1; 
-  else if(regVal == 1)
-    return 5;
-  else if(regVal == 2)
-    return 9; 
-  else if(regVal == 3)
-    return 16; 
-  else 
-    return regVal;
-  
+// Load shedding uses the lightning threshold above as a hardware strike
+// aggregator. When more than _maxIrqPerMin lightning interrupts arrive in
+// a minute the threshold is raised to 5, then 9, then 16. Disabling it
+// restores a threshold of 1. 
+void SparkFun_AS3935::loadShedding( bool _enable, uint16_t _maxIrqPerMin )
+{
+  if( _maxIrqPerMin == 0 )
+    return; 
+
+  _lsMaxIrq = _maxIrqPerMin; 
+  if( _enable == _lsEnabled )
+    return; 
+
+  _lsEnabled = _enable; 
+  _lsIrqCount = 0; 
+  _lsWindowStrikes = 0; 
+  _lsWindowStart = millis(); 
+  if( !_enable && (_lsLevel != 0) )
+    _shedLevel(0); 
+}
+
+// Give this function the value returned by readInterruptReg() after every
+// event, and call it with zero periodically so that a falling rate is seen. 
+// At level L the rate is measured over a window of as many minutes as the
+// threshold has strikes, so that at 16 the window covers the IC's own 15
+// minute window and a slow storm still produces at least one interrupt in it. 
+void SparkFun_AS3935::shedLoad( uint8_t _intVal )
+{
+  if( !_lsEnabled )
+    return; 
+
+  if( _intVal == LIGHTNING ) {
+    _lsStrikes += shedStrikes[_lsLevel]; 
+    _lsWindowStrikes += shedStrikes[_lsLevel]; 
+    _lsIrqCount++; 
+    // The IC keeps interrupting on every strike once the threshold has been
+    // reached, clearing the statistics starts the next count from zero. 
+    if( _lsLevel != 0 )
+      clearStatistics(true); 
+  }
+
+  // Too many interrupts for the service loop even at this threshold, don't
+  // wait for the window. The window is as many minutes long as the threshold
+  // has strikes, so is the budget. 
+  if( (_lsIrqCount > ((uint32_t)_lsMaxIrq * shedStrikes[_lsLevel])) && (_lsLevel < 3) ) {
+    _shedLevel(_lsLevel + 1); 
+    return;
+  }
+
+  if( (millis() - _lsWindowStart) < (shedStrikes[_lsLevel] * 60000UL) )
+    return; 
+
+  // Strikes per minute over the window, had the threshold been 1.
+  uint32_t rate = _lsWindowStrikes / shedStrikes[_lsLevel];
+  if( (rate < (_lsMaxIrq / 2)) && (_lsLevel > 0) )
+    _shedLevel(_lsLevel - 1); 
+  else {
+    _lsIrqCount = 0; 
+    _lsWindowStrikes = 0; 
+    _lsWindowStart = millis(); 
+  }
+}
+
+// Applies the threshold for the given load shedding level and starts a new
+// measurement window. Statistics are cleared so that strikes counted towards
+// the old threshold are not mistaken for a full count of the new one. 
+void SparkFun_AS3935::_shedLevel( uint8_t _level )
+{
+  _lsLevel = _level; 
+  lightningThreshold(shedStrikes[_lsLevel]); 
+  clearStatistics(true); 
+  _lsIrqCount = 0; 
+  _lsWindowStrikes = 0; 
+  _lsWindowStart = millis(); 
 }
 
 // REG0x02, bit [6], manufacturer default: 1. 
@@ -246,14 +514,251 @@ uint8_t SparkFun_AS3935::readInterruptReg()
     // A 2ms delay is added to allow for the memory register to be populated 
     // after the interrupt pin goes HIGH. See "Interrupt Management" in
     // datasheet. 
+    AS3935_TRACE_BEGIN(TRACE_IRQ_WAIT, 0); 
     delay(2);
+    AS3935_TRACE_END(TRACE_IRQ_WAIT, 0); 
+
+    return _readInterrupt(); 
+
+}
+
+// Polling mode read of a complete event. The energy and distance registers
+// are only read when the interrupt register shows lightning, and an event
+// that is known to be the last one again is counted as a duplicate rather
+// than returned again. Lightning is known by its energy and distance within
+// its one second read window, and INT_NH persists for as long as the noise
+// does, so a second one within 1.5 seconds is the same noise. Disturbers
+// carry nothing to tell two apart and are never suppressed. 
+bool SparkFun_AS3935::pollEvent( lightningEvent &_event )
+{
+  lightningEvent event; 
+  if( !_readEvent(event) ) // Nothing latched.
+    return false; 
 
-    uint8_t _interValue; 
-    _interValue = _readRegister(INT_MASK_ANT); 
-    _interValue &= INT_MASK; 
+  bool repeat = false; 
+  uint32_t age = event.timestamp - _lastEvent.timestamp; 
+  if( event.type == _lastEvent.type ) {
+    if( event.type == LIGHTNING )
+      repeat = (event.energy == _lastEvent.energy) && (event.distance == _lastEvent.distance) && (age < 1000); 
+    else if( event.type == NOISE_TO_HIGH )
+      repeat = (age < 1500); 
+  }
+  if( repeat ) {
+    _dupCount++; 
+    _sequence--; // Not a new event, so it doesn't get a number. 
+    return false; 
+  }
+
+  _lastEvent = event; 
+  _event = event; 
+  return true; 
+}
+
+// Every read of the interrupt register goes through here. An event gets the
+// next sequence number, and a read that comes after the IC's read window
+// for the pending IRQ (one second for lightning, 1.5 otherwise) is counted
+// as a missed window. A read that finds the register already empty may have
+// lost lightning, so the shorter window is used for it. 
+uint8_t SparkFun_AS3935::_readInterrupt()
+{
+  uint32_t age; 
+  bool pending = _takeIrq(age); 
+  return _countInterrupt(decodeInterrupt(_readRegister(INT_MASK_ANT)), pending, age); 
+}
+
+// Takes the pending IRQ edge, if there is one, before REG0x03 is read. It's
+// done with interrupts off and before the read so that an edge arriving
+// while the register is read stays pending, rather than being cleared with
+// the one that was read. Returns whether an edge was pending and its age in
+// microseconds. 
+bool SparkFun_AS3935::_takeIrq(uint32_t &_age)
+{
+  noInterrupts(); 
+  bool pending = _irqPending; 
+  uint32_t time = _irqTime; 
+  _irqPending = false; 
+  interrupts(); 
+  _age = micros() - time; 
+  return pending; 
+}
+
+// The accounting of _readInterrupt(), also for reads of REG0x03 that are part
+// of a longer burst. _pending and _age come from _takeIrq() before the read.
+// Returns _interValue. 
+uint8_t SparkFun_AS3935::_countInterrupt(uint8_t _interValue, bool _pending, uint32_t _age)
+{
+  if( _pending ) {
+    bool slow = (_interValue == DISTURBER_DETECT) || (_interValue == NOISE_TO_HIGH); 
+    uint32_t readWindow = slow ? 1500000UL : 1000000UL; 
+    if( _age > readWindow )
+      _missedWindows++; 
+  }
 
-    return(_interValue); 
+  if( _interValue != 0 )
+    _sequence++; 
+  return _interValue; 
+}
 
+// Reads the interrupt register and, only for lightning, the energy and
+// distance registers REG0x04-REG0x07 in a single burst. Returns false if
+// nothing was latched. 
+bool SparkFun_AS3935::_readEvent( lightningEvent &_event )
+{
+  _event.type = _readInterrupt(); 
+  _event.sequence = _sequence; 
+  _event.timestamp = millis(); 
+  _event.energy = 0; 
+  _event.distance = 0; 
+  if( _event.type == 0 )
+    return false; 
+
+  if( _event.type == LIGHTNING ) {
+    uint8_t regs[4]; 
+    _readRegisters(ENERGY_LIGHT_LSB, regs, 4); 
+    _event.energy = decodeEnergy(regs); 
+    _event.distance = decodeDistance(regs[3]); 
+  }
+  return true; 
+}
+
+// Non-blocking interrupt handling. Call irqEdge() from the IRQ pin's rising
+// edge interrupt, it only stores the time. 
+void SparkFun_AS3935::irqEdge()
+{
+  AS3935_TRACE_INSTANT(TRACE_IRQ_EDGE, 0); 
+  if( _irqPending ) // The last one was never read. 
+    _irqOverruns++; 
+  _irqTime = micros(); 
+  _irqPending = true; 
+}
+
+// Reads the interrupt register without the 2ms wait in readInterruptReg(),
+// for use once interruptReady() returns true. 
+uint8_t SparkFun_AS3935::readInterruptRegNow()
+{
+  return _readInterrupt(); 
+}
+
+// Sleep hooks. _enterSleep is called with true for a light sleep, which must
+// wake again within a millisecond or so (a timer tick will do), and with false
+// for a deep sleep that only the IRQ pin needs to wake from. _exitSleep is
+// called after either sleep returns. 
+void SparkFun_AS3935::sleepHooks( void (*_enterSleep)(bool _light), void (*_exitSleep)() )
+{
+  _sleepEnter = _enterSleep; 
+  _sleepExit = _exitSleep; 
+}
+
+// Events are collected and given to _upload _size at a time, so that a
+// radio only has to be woken once per batch. 
+void SparkFun_AS3935::uploadHook( void (*_upload)(const lightningEvent *_events, uint8_t _count), uint8_t _size )
+{
+  if( (_size == 0) || (_size > AS3935_BATCH_MAX) )
+    return; 
+
+  _uploadFn = _upload; 
+  _batchSize = _size; 
+}
+
+// Call this from loop(). With no IRQ pending it deep sleeps until the IRQ pin
+// wakes the processor. With one pending it light sleeps away the rest of the
+// 2ms population wait, reads the event in as few transactions as possible
+// (one, or two for lightning), adds it to the upload batch and returns true.
+// The awake time is measured from the IRQ edge. 
+bool SparkFun_AS3935::sleepService()
+{
+  // The check and the deep sleep must be one step, or an edge arriving in
+  // between is slept through. The IC holds IRQ HIGH until it's read so no
+  // other edge would come to wake the processor. 
+  noInterrupts(); 
+  if( !_irqPending ) {
+    if( _sleepEnter != NULL )
+      _sleepEnter(false); // Enables interrupts as it sleeps. 
+    else
+      interrupts(); 
+    if( _sleepExit != NULL )
+      _sleepExit(); 
+    return false; 
+  }
+  interrupts(); 
+
+  while( !interruptReady() ) {
+    if( _sleepEnter != NULL )
+      _sleepEnter(true); 
+    if( _sleepExit != NULL )
+      _sleepExit(); 
+  }
+
+  lightningEvent event; 
+  if( _readEvent(event) ) {
+    _batch[_batchCount++] = event; 
+    if( _batchCount > _batchHighWater )
+      _batchHighWater = _batchCount; 
+    if( _batchCount >= _batchSize )
+      flushBatch(); 
+  }
+
+  _awakeUs = _irqAge(); 
+  if( _awakeUs > _awakeMaxUs )
+    _awakeMaxUs = _awakeUs; 
+  return true; 
+}
+
+// Gives any batched events to the upload hook now. 
+void SparkFun_AS3935::flushBatch()
+{
+  if( (_uploadFn != NULL) && (_batchCount != 0) )
+    _uploadFn(_batch, _batchCount); 
+  else
+    _batchDrops += _batchCount; // Nowhere to send them. 
+  _batchCount = 0; 
+}
+
+// Noise episode tracking. An episode starts on the first NOISE_TO_HIGH and
+// ends on the first read of the interrupt register without it. 
+void SparkFun_AS3935::trackNoise( uint8_t _intVal )
+{
+  _nhLastPoll = millis(); 
+
+  if( _intVal & NOISE_TO_HIGH ) {
+    if( !_nhActive ) {
+      _nhActive = true; 
+      _nhStart = _nhLastPoll; 
+      _nhDuration = 0;
+      _nhCount++; 
+    }
+  }
+  else if( _nhActive ) {
+    _nhActive = false; 
+    _nhDuration = _nhLastPoll - _nhStart; 
+  }
+}
+
+// Outside of a noise episode the interrupt register is read whenever the IRQ
+// pin is HIGH, during one it's read once per noise poll interval regardless
+// of the pin, so that the end of the episode is still seen. 
+bool SparkFun_AS3935::serviceDue( bool _irqPinHigh )
+{
+  if( !_nhActive )
+    return _irqPinHigh; 
+
+  return ( (millis() - _nhLastPoll) >= _nhPollMs ); 
+}
+
+// Sets how often the interrupt register is read during a noise episode. 
+void SparkFun_AS3935::noisePollInterval( uint16_t _intervalMs )
+{
+  _nhPollMs = _intervalMs; 
+}
+
+// Returns the length in milliseconds of the active noise episode, or of
+// the last one if none is active. 
+uint32_t SparkFun_AS3935::noiseEpisodeDuration()
+{
+  if( _nhActive )
+    return millis() - _nhStart; 
+
+  return _nhDuration; 
 }
 
 // REG0x03, bit [5], manufacturere default: 0.
@@ -270,15 +775,6 @@ void SparkFun_AS3935::maskDisturber(bool _state)
 }
 
 
-// REG0x03, bit [5], manufacturere default: 0.
-// This setting will return whether or not disturbers trigger the IRQ Pin. 
-uint8_t SparkFun_AS3935::readMaskDisturber(){
-
-  uint8_t regVal = _readRegister(INT_MASK_ANT);
-  return (regVal &= ~DISTURB_MASK) >> 5;
-
-}
-
 // REG0x03, bit [7:6], manufacturer default: 0 (16 division ratio). 
 // The antenna is designed to resonate at 500kHz and so can be tuned with the
 // following setting. The accuracy of the antenna must be within 3.5 percent of
@@ -303,40 +799,13 @@ void SparkFun_AS3935::changeDivRatio(uint8_t _divisionRatio)
 
 }
 
-// REG0x03, bit [7:6], manufacturer default: 0 (16 division ratio). 
-// This function returns the current division ratio of the resonance frequency.
-// The antenna resonance frequency should be within 3.5 percent of 500kHz, and
-// so when modifying the resonance frequency with the internal capacitors
-// (tuneCap()) it's important to keep in mind that the displayed frequency on
-// the IRQ pin is divided by this number. 
-uint8_t SparkFun_AS3935::readDivRatio(){
-
-  uint8_t regVal = _readRegister(INT_MASK_ANT); 
-  regVal &= ~DIV_MASK; 
-  regVal >>= 6; // Front of the line. 
-
-  if( regVal == 0 )
-    return 16; 
-  else if(regVal == 1) 
-    return 32;
-  else if(regVal == 2)
-    return 64;
-  else if (regVal == 3) 
-    return 128; 
-  else
-    return UNKNOWN_ERROR;
-
-}
-
 // REG0x07, bit [5:0], manufacturer default: 0. 
 // This register holds the distance to the front of the storm and not the
 // distance to a lightning strike.  
 uint8_t SparkFun_AS3935::distanceToStorm()
 {
 
-  uint8_t _dist = _readRegister(DISTANCE); 
-  _dist &= DISTANCE_MASK; 
-  return(_dist); 
+  return decodeDistance(_readRegister(DISTANCE)); 
 
 }
 
@@ -388,17 +857,6 @@ void SparkFun_AS3935::tuneCap(uint8_t farad)
   _writeRegister(FREQ_DISP_IRQ, CAP_MASK, farad, 0);    
 }
 
-// REG0x08, bits [3:0], manufacturer default: 0. 
-// This setting will return the capacitance of the internal capacitors. It will
-// return a value from one to 15 multiplied by the 8pF steps of the internal
-// capacitance.
-uint8_t SparkFun_AS3935::readTuneCap(){
-
-  uint8_t regVal = _readRegister(FREQ_DISP_IRQ);
-  return ((regVal &= ~CAP_MASK) * 8); //Multiplied by 8pF
-
-}
-
 // LSB =  REG0x04, bits[7:0]
 // MSB =  REG0x05, bits[7:0]
 // MMSB = REG0x06, bits[4:0]
@@ -408,14 +866,183 @@ uint8_t SparkFun_AS3935::readTuneCap(){
 uint32_t SparkFun_AS3935::lightningEnergy()
 {
 
-  uint32_t _pureLight = _readRegister(ENERGY_LIGHT_MMSB);
-  _pureLight &= ENERGY_MASK; 
-  _pureLight <<= 8;
-  _pureLight |= _readRegister(ENERGY_LIGHT_MSB);
-  _pureLight <<= 8;
-  _pureLight |= _readRegister(ENERGY_LIGHT_LSB);
-  return _pureLight;
+  uint8_t _energy[3]; 
+  _readRegisters(ENERGY_LIGHT_LSB, _energy, 3); // One burst read for all three.
+
+  return decodeEnergy(_energy);
+
+}
+
+// Presence tracking. Call this periodically: while the sensor is connected
+// it's probed once per probe interval, and once it has gone missing it's
+// probed with an exponential backoff from 100ms up to a minute. When it
+// answers again the shadowed configuration is restored and the oscillators
+// are recalibrated, since a sensor that lost power has lost both. Returns
+// whether the sensor is connected.
+bool SparkFun_AS3935::checkConnection()
+{
+  if( (millis() - _lastProbe) < (_connected ? _probeMs : _backoffMs) )
+    return _connected; 
+
+  if( _connected ) {
+    if( !busAvailable() ) // Probing a healthy sensor can wait.
+      return _connected; 
+    _lastProbe = millis(); 
+    if( !_probe() ) {
+      _connected = false; 
+      _backoffMs = 100; 
+    }
+    return _connected; 
+  }
+
+  _lastProbe = millis(); 
+  if( _probe() ) {
+    _restoreConfig(); 
+    if( (!_verify || _verifyWrites(2)) && calibrateOsc() ) {
+      _connected = true; 
+      _failRun = 0; 
+      _reconnects++; 
+      return true; 
+    }
+  }
+
+  _backoffMs *= 2; 
+  if( _backoffMs > 60000 )
+    _backoffMs = 60000; 
+  return false; 
+}
+
+// Sets how often checkConnection() probes a connected sensor, default is
+// every five seconds. 
+void SparkFun_AS3935::probeInterval( uint32_t _intervalMs )
+{
+  _probeMs = _intervalMs; 
+}
+
+// Bus utilisation governor. Limits the share of bus time used for work that
+// can wait, given as a percentage of each window. 100 disables the governor. 
+void SparkFun_AS3935::busBudget( uint8_t _percent, uint32_t _windowMs )
+{
+  if( (_percent > 100) || (_windowMs == 0) )
+    return; 
+
+  _busBudget = _percent; 
+  _busWindowMs = _windowMs; 
+  _busBusyUs = 0; 
+  _busWindowStart = micros(); 
+}
+
+// Returns false when the current window has already used up its budget.
+// Connection probes of a healthy sensor and auto ranging gain steps are
+// deferred until this returns true, reads of the interrupt register,
+// energy and distance never are. 
+bool SparkFun_AS3935::busAvailable()
+{
+  if( _busBudget >= 100 )
+    return true; 
+
+  // Roll the window over if it has ended without any traffic.
+  _busTime(micros()); 
+  return ( _busBusyUs < ((_busWindowMs * 10UL) * _busBudget) ); 
+}
+
+// Link rate fallback. When enabled the bus clock steps down when transaction
+// errors rise and back up towards the rate given to begin() or beginSPI()
+// once they've stayed away. 
+void SparkFun_AS3935::linkFallback( bool _enable )
+{
+  _linkFallback = _enable; 
+  _linkTx = 0; 
+  _linkErr = 0; 
+  _linkClean = 0; 
+}
+
+// Write verify mode. While enabled every register written is remembered so
+// that verifyWrites() can check them all with a single burst read. 
+void SparkFun_AS3935::writeVerify( bool _enable )
+{
+  _verify = _enable; 
+  _verifyPending = 0; 
+}
+
+// Reads back every register written since the last verifyWrites() in one
+// burst covering the lowest to the highest of them and compares each with
+// its shadow image. Only the registers that don't match are written again,
+// and then only those are read back, up to _retries times. Returns true when
+// every register matches. Integrity checks can wait, so with the bus budget
+// used up the writes are left pending. 
+bool SparkFun_AS3935::verifyWrites( uint8_t _retries )
+{
+  if( !busAvailable() )
+    return false; 
+
+  return _verifyWrites(_retries); 
+}
+
+// The work of verifyWrites(), also used by checkConnection() where it
+// mustn't wait for the bus budget. 
+bool SparkFun_AS3935::_verifyWrites( uint8_t _retries )
+{
+  uint8_t readBack[FREQ_DISP_IRQ + 1]; 
+
+  for( uint8_t attempt = 0; _verifyPending && (attempt <= _retries); attempt++ ) {
+    uint8_t first = AFE_GAIN; 
+    while( !(_verifyPending & (1 << first)) )
+      first++; 
+    uint8_t last = FREQ_DISP_IRQ; 
+    while( !(_verifyPending & (1 << last)) )
+      last--; 
+
+    // Reading REG0x03 clears a latched event. When it isn't one of the
+    // registers being checked it's left out of the burst, and when it is the
+    // event is accounted for like any other read of it, though it's lost. 
+    bool spansIrq = (first < INT_MASK_ANT) && (last > INT_MASK_ANT); 
+    if( spansIrq && !(_verifyPending & (1 << INT_MASK_ANT)) ) {
+      if( !_readRegisters(first, &readBack[first], INT_MASK_ANT - first) ||
+          !_readRegisters(INT_MASK_ANT + 1, &readBack[INT_MASK_ANT + 1], last - INT_MASK_ANT) )
+        continue; 
+    }
+    else if( _verifyPending & (1 << INT_MASK_ANT) ) {
+      uint32_t age; 
+      bool pending = _takeIrq(age); 
+      bool _ok = _readRegisters(first, &readBack[first], (last - first) + 1); 
+      // A failed read may still have cleared the event. 
+      _countInterrupt(_ok ? decodeInterrupt(readBack[INT_MASK_ANT]) : 0, pending, age); 
+      if( !_ok )
+        continue; 
+    }
+    else if( !_readRegisters(first, &readBack[first], (last - first) + 1) )
+      continue; 
+
+    uint16_t mismatched = 0; 
+    for( uint8_t reg = first; reg <= last; reg++ ) {
+      if( !(_verifyPending & (1 << reg)) )
+        continue; 
+      // The interrupt bits of REG0x03 are read only. 
+      uint8_t mask = (reg == INT_MASK_ANT) ? (uint8_t)~INT_MASK : 0xFF; 
+      if( (readBack[reg] & mask) != (_shadowReg[reg] & mask) )
+        mismatched |= (1 << reg); 
+    }
+
+    _verifyPending = 0; 
+    if( !mismatched )
+      return true; 
+
+    if( attempt < _retries ) {
+      for( uint8_t reg = first; reg <= last; reg++ ) {
+        if( mismatched & (1 << reg) ) {
+          _writeByte(reg, _shadowReg[reg]); 
+          if( _verifyRetries < 0xFFFF )
+            _verifyRetries++; 
+        }
+      }
+    }
+    _verifyPending = mismatched; 
+  }
 
+  bool _ok = (_verifyPending == 0); 
+  _verifyPending = 0; 
+  return _ok; 
 }
 
 // REG0x3D, bits[7:0]
@@ -424,14 +1051,66 @@ uint32_t SparkFun_AS3935::lightningEnergy()
 // before the calibration is done. 
 bool SparkFun_AS3935::calibrateOsc(){
 
-  _writeRegister(CALIB_RCO, WIPE_ALL, DIRECT_COMMAND, 0); // Send command to calibrate the oscillators 
+  _calibStart(); 
   Serial.println("Calibrating Oscillators");
-
-  displayOscillator(true, 2);
   delay(2); // Give time for the internal oscillators to start up.  
   displayOscillator(false, 2); 
 
-  // Check it they were calibrated successfully.   
+  return _calibCheck(); 
+}
+
+// Calibrates the oscillators of many sensors at once. The CALIB_RCO direct
+// command is sent to every sensor back to back and a single 2ms wait covers
+// them all, then CALIB_TRCO and CALIB_SRCO are checked on each. Only the
+// sensors that failed are tried again, up to _retries times. If _results is
+// given it's filled with each sensor's outcome. Returns true when every
+// sensor calibrated. 
+bool SparkFun_AS3935::calibrateOscAll(SparkFun_AS3935 *_sensors[], uint8_t _count, bool *_results, uint8_t _retries)
+{
+  uint8_t failed = _count; 
+  uint8_t passed[32]; // One bit per sensor. 
+  memset(passed, 0, sizeof(passed)); 
+
+  for( uint8_t attempt = 0; (attempt <= _retries) && failed; attempt++ ) {
+    // Sensors that have already passed are left alone. 
+    for( uint8_t i = 0; i < _count; i++ ) {
+      if( !(passed[i >> 3] & (1 << (i & 7))) )
+        _sensors[i]->_calibStart(); 
+    }
+
+    delay(2); // Give time for the internal oscillators to start up.  
+
+    failed = 0; 
+    for( uint8_t i = 0; i < _count; i++ ) {
+      if( passed[i >> 3] & (1 << (i & 7)) )
+        continue; 
+      _sensors[i]->displayOscillator(false, 2); 
+      if( _sensors[i]->_calibCheck() )
+        passed[i >> 3] |= (1 << (i & 7)); 
+      else
+        failed++; 
+    }
+  }
+
+  if( _results != NULL ) {
+    for( uint8_t i = 0; i < _count; i++ )
+      _results[i] = passed[i >> 3] & (1 << (i & 7)); 
+  }
+
+  return (failed == 0); 
+}
+
+// Sends the "Direct Command" to CALIB_RCO and displays the SRCO on the IRQ
+// pin, which the calibration needs for 2ms. 
+void SparkFun_AS3935::_calibStart()
+{
+  _writeRegister(CALIB_RCO, WIPE_ALL, DIRECT_COMMAND, 0); // Send command to calibrate the oscillators 
+  displayOscillator(true, 2);
+}
+
+// Check it they were calibrated successfully.   
+bool SparkFun_AS3935::_calibCheck()
+{
   uint8_t regValSrco = _readRegister(CALIB_SRCO);
   uint8_t regValTrco = _readRegister(CALIB_TRCO);
 
@@ -446,11 +1125,36 @@ bool SparkFun_AS3935::calibrateOsc(){
     return false; 
 }
 
+// Applies one of the presets in SF_AS3935_PRESETS with a single burst write
+// of REG0x00-REG0x03. The preset is read straight from program memory, and
+// the division ratio in REG0x03 is kept as it is. 
+void SparkFun_AS3935::applyPreset(uint8_t _preset)
+{
+  if( _preset >= PRESET_COUNT )
+    return; 
+
+  uint8_t regs[4]; 
+  for( uint8_t i = 0; i < 3; i++ )
+    regs[i] = pgm_read_byte(&presetTable[_preset][i]); 
+  // Power down and the division ratio are kept as they are: waking the IC
+  // needs the oscillators recalibrated, which is left to wakeUp(). 
+  uint8_t gainReg; 
+  uint8_t maskReg; 
+  if( !_currentRegister(AFE_GAIN, gainReg) || !_currentRegister(INT_MASK_ANT, maskReg) )
+    return; // A read failed. 
+  regs[0] |= gainReg & ~POWER_MASK; 
+  regs[3] = maskReg & DISTURB_MASK; 
+  regs[3] |= pgm_read_byte(&presetTable[_preset][3]) << 5; 
+
+  _writeRegisters(AFE_GAIN, regs, 4); 
+}
+
 // REG0x3C, bits[7:0]
 // This function resets all settings to their default values. 
 void SparkFun_AS3935::resetSettings(){
       
   _writeRegister(RESET_LIGHT, WIPE_ALL, DIRECT_COMMAND, 0);
+  _shadowValid = 0; // Every register is back to its default.
 
 }
 
@@ -460,51 +1164,655 @@ void SparkFun_AS3935::resetSettings(){
 // the given start position.  
 void SparkFun_AS3935::_writeRegister(uint8_t _wReg, uint8_t _mask, uint8_t _bits, uint8_t _startPosition)
 {
-  if(_i2cPort == NULL) {
-    _spiWrite = _readRegister(_wReg); // Get the current value of the register
-    _spiWrite &= _mask; // Mask the position we want to write to
-    _spiWrite |= (_bits << _startPosition); // Write the given bits to the variable
-    _spiPort->beginTransaction(mySpiSettings); 
-    digitalWrite(_cs, LOW); // Start communication
-    _spiPort->transfer(_wReg); // Start write command at given register
-    _spiPort->transfer(_spiWrite); // Write to register
-    digitalWrite(_cs, HIGH); // End communcation
-    _spiPort->endTransaction();
+  uint8_t _writeVal; 
+  if( !_currentRegister(_wReg, _writeVal) ) // Get the current value of the register
+    return; // The read failed, writing would corrupt the other bits. 
+  _writeVal &= _mask; // Mask the position we want to write to.
+  _writeVal |= (_bits << _startPosition);  // Write the given bits to the variable
+  _writeByte(_wReg, _writeVal); 
+}
+
+// This function writes a whole byte to the given register. 
+void SparkFun_AS3935::_writeByte(uint8_t _wReg, uint8_t _value)
+{
+  _writeRegisters(_wReg, &_value, 1); 
+}
+
+// This function writes _len registers in one burst starting at the given
+// register and keeps the shadow of REG0x00-REG0x08 up to date. A failed
+// write leaves the shadow as it was. Returns false if the transaction failed. 
+bool SparkFun_AS3935::_writeRegisters(uint8_t _wReg, const uint8_t *_values, uint8_t _len)
+{
+  AS3935_TRACE_BEGIN(TRACE_WRITE, _wReg); 
+  uint32_t _start = micros(); 
+  bool _ok = true; 
+  if( _softI2c ) {
+    _ok = _swStart() && _swWrite(_address << 1) && _swWrite(_wReg); 
+    for( uint8_t i = 0; (i < _len) && _ok; i++ )
+      _ok = _swWrite(_values[i]); 
+    _ok = _swStop() && _ok; 
+  }
+  else if(_i2cPort == NULL) {
+    _spiSelect(); // Start communication
+    _spiTransfer(_wReg); // Start write command at given register
+    for( uint8_t i = 0; i < _len; i++ )
+      _spiTransfer(_values[i]); // Write to register
+    _spiDeselect(false); // End communcation
   }
   else { 
-    _i2cWrite = _readRegister(_wReg); // Get the current value of the register
-    _i2cWrite &= _mask; // Mask the position we want to write to.
-    _i2cWrite |= (_bits << _startPosition);  // Write the given bits to the variable
     _i2cPort->beginTransmission(_address); // Start communication.
     _i2cPort->write(_wReg); // at register....
-    _i2cPort->write(_i2cWrite); // Write register...
-    _i2cPort->endTransmission(); // End communcation.
+    for( uint8_t i = 0; i < _len; i++ )
+      _i2cPort->write(_values[i]); // Write register...
+    _ok = (_i2cPort->endTransmission() == 0); // End communcation.
+  }
+
+  _busTime(_start); 
+  _transaction(_ok); 
+  AS3935_TRACE_END(TRACE_WRITE, _wReg); 
+  if( !_ok )
+    return false; 
+
+  for( uint8_t i = 0; i < _len; i++ ) {
+    uint8_t reg = _wReg + i; 
+    if( reg > FREQ_DISP_IRQ )
+      break; 
+    _shadowReg[reg] = _values[i]; 
+    _shadowValid |= (1 << reg); 
+    if( _verify )
+      _verifyPending |= (1 << reg); 
+  }
+  return true; 
+}
+
+// Gets the current image of the given register into _value, from the shadow
+// if it's valid or from the IC if it's not. A successful read fills the
+// shadow. Returns false, and caches nothing, if the read failed. 
+bool SparkFun_AS3935::_currentRegister(uint8_t _reg, uint8_t &_value)
+{
+  if( (_reg <= FREQ_DISP_IRQ) && (_shadowValid & (1 << _reg)) ) {
+    _value = _shadowReg[_reg]; 
+    return true; 
+  }
+
+  if( !_readRegisters(_reg, &_value, 1) )
+    return false; 
+  if( _reg <= FREQ_DISP_IRQ ) {
+    _shadowReg[_reg] = _value; 
+    _shadowValid |= (1 << _reg); 
+  }
+  return true;
+}
+
+// Fills the shadow of a register for the settings getters. The interrupt
+// bits [3:0] of REG0x03 are read only and clear when read, they're never
+// served from the shadow (the getters only use its writable bits), so a
+// fill of REG0x03 goes through the same counting as _readInterrupt() and an
+// event it clears still shows as a gap in the sequence numbers.
+uint8_t SparkFun_AS3935::_fetchRegister(uint8_t _reg)
+{
+  uint8_t regVal = 0;
+  if( _reg != INT_MASK_ANT ) {
+    _currentRegister(_reg, regVal);
+    return regVal;
+  }
+
+  uint32_t age;
+  bool pending = _takeIrq(age);
+  bool ok = _currentRegister(_reg, regVal);
+  _countInterrupt(ok ? decodeInterrupt(regVal) : 0, pending, age);
+  return regVal;
+}
+
+// Software I-squared-C. SDA and SCL are open drain: a line is driven LOW by
+// making its pin an output and released by making it an input. Releasing
+// SCL waits for the line to actually go HIGH, which is where a slave
+// stretches the clock, for at most _swTimeoutUs. A timeout anywhere sets
+// _swFault, which fails the transaction and makes the stop clock the bus free.
+bool SparkFun_AS3935::_swWait(uint8_t _pin)
+{
+  uint32_t _start = micros(); 
+  while( digitalRead(_pin) == LOW ) {
+    if( (micros() - _start) > _swTimeoutUs ) {
+      if( !_swFault && (_swTimeouts < 0xFFFF) )
+        _swTimeouts++; 
+      _swFault = true; 
+      return false; 
+    }
+  }
+  return true; 
+}
+
+void SparkFun_AS3935::_swLine(uint8_t _pin, bool _high)
+{
+  pinMode(_pin, _high ? INPUT : OUTPUT); 
+  if( _softHalfUs )
+    delayMicroseconds(_softHalfUs); 
+}
+
+// Start condition, SDA falls while SCL is HIGH. Fails if another device is
+// holding either line. 
+bool SparkFun_AS3935::_swStart()
+{
+  _swFault = false; 
+  _swLine(_sda, true); 
+  _swLine(_scl, true); 
+  if( !_swWait(_scl) || !_swWait(_sda) )
+    return false; 
+  _swLine(_sda, false); 
+  _swLine(_scl, false); 
+  return true; 
+}
+
+// Repeated start, the bus isn't released between the register pointer write
+// and the read. 
+bool SparkFun_AS3935::_swRestart()
+{
+  _swLine(_sda, true); 
+  _swLine(_scl, true); 
+  if( !_swWait(_scl) )
+    return false; 
+  _swLine(_sda, false); 
+  _swLine(_scl, false); 
+  return true; 
+}
+
+// Stop condition, SDA rises while SCL is HIGH. After a fault up to nine
+// clocks are sent first so that a slave stuck mid byte lets go of SDA. 
+bool SparkFun_AS3935::_swStop()
+{
+  bool _ok = !_swFault; 
+  if( _swFault ) {
+    _swLine(_sda, true); 
+    for( uint8_t i = 0; (i < 9) && (digitalRead(_sda) == LOW); i++ ) {
+      _swLine(_scl, true); 
+      _swLine(_scl, false); 
+    }
+    _swFault = false; 
+  }
+
+  _swLine(_sda, false); 
+  _swLine(_scl, true); 
+  _swWait(_scl); 
+  _swLine(_sda, true); 
+  _ok = _ok && !_swFault && (digitalRead(_sda) == HIGH); 
+  _swFault = false; 
+  return _ok; 
+}
+
+// Writes a byte MSB first and returns whether the slave acknowledged it. 
+bool SparkFun_AS3935::_swWrite(uint8_t _data)
+{
+  for( uint8_t bit = 0x80; bit; bit >>= 1 ) {
+    _swLine(_sda, _data & bit); 
+    _swLine(_scl, true); 
+    if( !_swWait(_scl) )
+      return false; 
+    _swLine(_scl, false); 
+  }
+
+  _swLine(_sda, true); // Slave drives the acknowledge.
+  _swLine(_scl, true); 
+  if( !_swWait(_scl) )
+    return false; 
+  bool _ack = (digitalRead(_sda) == LOW); 
+  _swLine(_scl, false); 
+  return _ack; 
+}
+
+// Reads a byte MSB first, then acknowledges it if more are to follow.
+uint8_t SparkFun_AS3935::_swRead(bool _ack)
+{
+  uint8_t _data = 0; 
+
+  _swLine(_sda, true); 
+  for( uint8_t bit = 0x80; bit; bit >>= 1 ) {
+    _swLine(_scl, true); 
+    if( !_swWait(_scl) )
+      return 0xFF; 
+    if( digitalRead(_sda) == HIGH )
+      _data |= bit; 
+    _swLine(_scl, false); 
+  }
+
+  _swLine(_sda, !_ack); 
+  _swLine(_scl, true); 
+  _swWait(_scl); 
+  _swLine(_scl, false); 
+  _swLine(_sda, true); 
+  return _data; 
+}
+
+// Records the result of an I-squared-C transaction. A run of failures marks
+// the sensor as disconnected so that checkConnection() starts trying to
+// bring it back. SPI has no acknowledge so failures there are only seen
+// by the probe.  
+void SparkFun_AS3935::_transaction(bool _ok)
+{
+  _txCount++; 
+  if( _linkFallback && !_usingSpi() )
+    _linkQuality(_ok); 
+
+  if( _ok ) {
+    _failRun = 0; 
+    return; 
+  }
+
+  if( _txErrors < 0xFFFF )
+    _txErrors++; 
+  if( _failRun < 0xFF )
+    _failRun++; 
+  if( (_failRun >= 3) && _connected ) {
+    _connected = false; 
+    _backoffMs = 100; 
+    _lastProbe = millis(); 
+  }
+}
+
+// Adds the time since _start to the bus busy time of the current window,
+// rolling the window over when it has ended. 
+void SparkFun_AS3935::_busTime(uint32_t _start)
+{
+  uint32_t now = micros(); 
+  _busBusyUs += now - _start; 
+  _busTotalUs += now - _start; 
+
+  uint32_t elapsed = now - _busWindowStart; 
+  if( elapsed >= (_busWindowMs * 1000UL) ) {
+    uint32_t util = _busBusyUs / (elapsed / 100); 
+    _busUtil = (util > 100) ? 100 : util; 
+    _busBusyUs = 0; 
+    _busWindowStart = now; 
+  }
+}
+
+// Steps the I-squared-C clock up to the requested rate. REG0x00-REG0x08 are
+// burst read at 100kHz as a reference, then each rate from the requested one
+// down is set and must return the same registers on two burst reads in a
+// row. The first rate that does becomes the ceiling for link fallback. 
+void SparkFun_AS3935::_negotiateClock(uint32_t _speed)
+{
+  uint8_t reference[FREQ_DISP_IRQ + 1]; 
+  uint8_t check[FREQ_DISP_IRQ + 1]; 
+
+  _setLinkSpeed(100000); 
+  if( !_readRegisters(AFE_GAIN, reference, sizeof(reference)) )
+    return; 
+
+  for( uint8_t i = 0; i < LINK_STEPS; i++ ) {
+    if( (i2cSteps[i] > _speed) || (i2cSteps[i] <= 100000) )
+      continue; 
+
+    _setLinkSpeed(i2cSteps[i]); 
+    bool _ok = true; 
+    for( uint8_t pass = 0; (pass < 2) && _ok; pass++ ) {
+      // The interrupt bits of REG0x03 may change between reads. 
+      _ok = _readRegisters(AFE_GAIN, check, sizeof(check)) &&
+        ((reference[INT_MASK_ANT] & ~INT_MASK) == (check[INT_MASK_ANT] & ~INT_MASK)); 
+      for( uint8_t reg = AFE_GAIN; (reg <= FREQ_DISP_IRQ) && _ok; reg++ ) {
+        if( reg == INT_MASK_ANT )
+          continue; 
+        _ok = (reference[reg] == check[reg]); 
+      }
+    }
+
+    if( _ok ) {
+      _linkCeiling = i2cSteps[i]; 
+      return; 
+    }
   }
+
+  _setLinkSpeed(100000); 
+}
+
+// Counts transactions and errors into windows of LINK_WINDOW transactions,
+// or of LINK_PROBE_WINDOW probes on SPI. A window with LINK_MAX_ERRORS
+// (LINK_PROBE_MAX_ERRORS) or more steps the clock down one rate, and
+// LINK_CLEAN_WINDOWS error free windows in a row step it back up one, never
+// above the rate given to begin() or beginSPI(). Does nothing while the
+// rate isn't known. 
+void SparkFun_AS3935::_linkQuality(bool _ok)
+{
+  bool spi = _usingSpi(); 
+  const uint32_t *steps = spi ? spiSteps : i2cSteps; 
+
+  if( _linkSpeed == 0 )
+    return; 
+
+  _linkTx++; 
+  if( !_ok )
+    _linkErr++; 
+  if( _linkTx < (spi ? LINK_PROBE_WINDOW : LINK_WINDOW) )
+    return; 
+
+  if( _linkErr >= (spi ? LINK_PROBE_MAX_ERRORS : LINK_MAX_ERRORS) ) {
+    _linkClean = 0; 
+    for( uint8_t i = 0; i < LINK_STEPS; i++ ) {
+      if( steps[i] < _linkSpeed ) {
+        _setLinkSpeed(steps[i]); 
+        _linkDown++; 
+        break; 
+      }
+    }
+  }
+  else if( (_linkErr == 0) && (++_linkClean >= LINK_CLEAN_WINDOWS) ) {
+    _linkClean = 0; 
+    for( int8_t i = LINK_STEPS - 1; i >= 0; i-- ) {
+      if( steps[i] > _linkSpeed ) {
+        uint32_t speed = (steps[i] > _linkCeiling) ? _linkCeiling : steps[i]; 
+        if( speed > _linkSpeed ) {
+          _setLinkSpeed(speed); 
+          _linkUp++; 
+        }
+        break; 
+      }
+    }
+  }
+  else if( _linkErr != 0 )
+    _linkClean = 0; 
+
+  _linkTx = 0; 
+  _linkErr = 0; 
+}
+
+// Sets the clock rate of the bus the sensor is on. 
+void SparkFun_AS3935::_setLinkSpeed(uint32_t _speed)
+{
+  _linkSpeed = _speed; 
+  _softHalfUs = 500000UL / _speed; // Half a clock period, zero at 1MHz and up.
+
+  if( _softI2c )
+    return; 
+
+  if( _i2cPort != NULL ) {
+    _i2cPort->setClock(_speed); 
+    return; 
+  }
+
+  _spiPortSpeed = _speed; 
+  // Bit order is different for ESP32
+#ifdef ESP32 
+  mySpiSettings = SPISettings(_speed, SPI_MSBFIRST, SPI_MODE1);  
+#else
+  mySpiSettings = SPISettings(_speed, MSBFIRST, SPI_MODE1);  
+#endif
+}
+
+// A lightweight check that the sensor is there. On I-squared-C it's an
+// address acknowledge, on SPI REG0x00 must read back with its reserved bits
+// [7:6] clear, which a MISO line that idles HIGH won't give. 
+bool SparkFun_AS3935::_probe()
+{
+  if( _softI2c ) {
+    bool _ack = _swStart() && _swWrite(_address << 1); 
+    return _swStop() && _ack; 
+  }
+
+  if( _i2cPort != NULL ) {
+    _i2cPort->beginTransmission(_address);
+    return (_i2cPort->endTransmission() == 0); 
+  }
+
+  // Read here rather than through _readRegisters() so that the probe is
+  // recorded as one transaction, with its real result. 
+  AS3935_TRACE_BEGIN(TRACE_READ, AFE_GAIN); 
+  uint32_t _start = micros(); 
+  _spiSelect(); 
+  _spiTransfer(AFE_GAIN | SPI_READ_M); 
+  uint8_t regVal = _spiTransfer(0); 
+  _spiDeselect(true); 
+  _busTime(_start); 
+  AS3935_TRACE_END(TRACE_READ, AFE_GAIN); 
+
+  bool _ok = ( (regVal & 0xC0) == 0 ); 
+  _transaction(_ok); // The only way an SPI error is seen.
+  if( _linkFallback )
+    _linkQuality(_ok); 
+  return _ok; 
+}
+
+// Writes the shadowed configuration back to a sensor that has lost it, a
+// single write per register with no read first. The interrupt bits of
+// REG0x03 are read only so writing their old value is harmless. 
+void SparkFun_AS3935::_restoreConfig()
+{
+  for( uint8_t reg = AFE_GAIN; reg <= FREQ_DISP_IRQ; reg++ ) {
+    if( (reg >= ENERGY_LIGHT_LSB) && (reg <= DISTANCE) ) // Read only.
+      continue; 
+    if( _shadowValid & (1 << reg) )
+      _writeByte(reg, _shadowReg[reg]); 
+  }
+}
+
+// Sets the library's state variables to their defaults, called by both
+// constructors. 
+void SparkFun_AS3935::_setDefaults()
+{
+  _i2cPort = NULL; 
+  _spiPort = NULL; 
+  _softSpi = false; 
+  _softI2c = false; 
+  _softHalfUs = 0; 
+  _swTimeoutUs = 1000; 
+  _swFault = false; 
+  _swTimeouts = 0; 
+  _shadowValid = 0; 
+
+  _agMinGain = 0; 
+  _agMaxGain = GAIN_MAX; 
+  _agDisturbLimit = 10; 
+  _agWindowMs = 60000; 
+  _agWindowStart = 0; 
+  _agNoise = 0; 
+  _agDisturber = 0; 
+  _agLightning = 0; 
+
+  _lsEnabled = false; 
+  _lsMaxIrq = 30; 
+  _lsLevel = 0; 
+  _lsIrqCount = 0; 
+  _lsWindowStrikes = 0; 
+  _lsWindowStart = 0; 
+  _lsStrikes = 0; 
+
+  _lastEvent.type = 0; 
+  _lastEvent.distance = 0; 
+  _lastEvent.energy = 0; 
+  _lastEvent.timestamp = 0; 
+  _lastEvent.sequence = 0; 
+  _dupCount = 0; 
+
+  _irqPending = false; 
+  _irqTime = 0; 
+  _sequence = 0; 
+  _missedWindows = 0; 
+  _irqOverruns = 0; 
+  _batchDrops = 0; 
+  _sleepEnter = NULL; 
+  _sleepExit = NULL; 
+  _uploadFn = NULL; 
+  _batchSize = 1; 
+  _batchCount = 0; 
+  _batchHighWater = 0; 
+  _awakeUs = 0; 
+  _awakeMaxUs = 0; 
+
+  _nhActive = false; 
+  _nhPollMs = 1000; 
+  _nhCount = 0; 
+  _nhStart = 0; 
+  _nhDuration = 0; 
+  _nhLastPoll = 0; 
+
+  _connected = true; 
+  _txCount = 0; 
+  _txErrors = 0; 
+  _failRun = 0; 
+  _probeMs = 5000; 
+  _backoffMs = 100; 
+  _lastProbe = 0; 
+  _reconnects = 0; 
+
+  _busBudget = 100; 
+  _busWindowMs = 1000; 
+  _busWindowStart = 0; 
+  _busBusyUs = 0; 
+  _busTotalUs = 0; 
+  _busUtil = 0; 
+
+  _linkFallback = false; 
+  _linkSpeed = 0; 
+  _linkCeiling = 0; 
+  _linkTx = 0; 
+  _linkErr = 0; 
+  _linkClean = 0; 
+  _linkDown = 0; 
+  _linkUp = 0; 
+
+  _verify = false; 
+  _verifyPending = 0; 
+  _verifyRetries = 0; 
+}
+
+// This function reads _len registers in one burst starting at the given
+// register, the IC increments the register address after every byte. Returns
+// false if the transaction failed. 
+bool SparkFun_AS3935::_readRegisters(uint8_t _reg, uint8_t *_buf, uint8_t _len)
+{
+  AS3935_TRACE_BEGIN(TRACE_READ, _reg); 
+  uint32_t _start = micros(); 
+  bool _ok = true; 
+
+  if( _softI2c ) {
+    // Register pointer write and read in one transaction with a repeated start. 
+    _ok = _swStart() && _swWrite(_address << 1) && _swWrite(_reg) && 
+      _swRestart() && _swWrite((_address << 1) | 1); 
+    for( uint8_t i = 0; i < _len; i++ )
+      _buf[i] = _ok ? _swRead(i < (_len - 1)) : 0xFF; // NACK the last byte.
+    _ok = _swStop() && _ok && !_swFault; 
+  }
+  else if(_i2cPort == NULL) {
+    _spiSelect(); // Start communication.
+    _spiTransfer(_reg | SPI_READ_M);  // Register OR'ed with SPI read command. 
+    for( uint8_t i = 0; i < _len; i++ )
+      _buf[i] = _spiTransfer(0); // Get data from register.  
+    _spiDeselect(true); 
+  }
+  else {
+    _i2cPort->beginTransmission(_address); 
+    _i2cPort->write(_reg); // Moves pointer to register.
+    uint8_t _ret = _i2cPort->endTransmission(false); // Restart, bus is not released.
+    uint8_t _count = _i2cPort->requestFrom(_address, _len); 
+    _ok = (_ret == 0) && (_count == _len); 
+    for( uint8_t i = 0; i < _len; i++ )
+      _buf[i] = _i2cPort->read(); 
+  }
+
+  _busTime(_start); 
+  _transaction(_ok); 
+  AS3935_TRACE_END(TRACE_READ, _reg); 
+  return _ok; 
 }
 
 // This function reads the given register. 
 uint8_t SparkFun_AS3935::_readRegister(uint8_t _reg)
 {
+  _readRegisters(_reg, &_regValue, 1); // Read the register, only ever once. 
+  return(_regValue); 
+}
 
-  if(_i2cPort == NULL) {
-    _spiPort->beginTransaction(mySpiSettings); 
-    digitalWrite(_cs, LOW); // Start communication.
-    _spiPort->transfer(_reg |= SPI_READ_M);  // Register OR'ed with SPI read command. 
-    _regValue = _spiPort->transfer(0); // Get data from register.  
-    // According to datsheet, the chip select must be written HIGH, LOW, HIGH
-    // to correctly end the READ command. 
-    digitalWrite(_cs, HIGH); 
+// Starts an SPI transaction and selects the sensor. 
+void SparkFun_AS3935::_spiSelect()
+{
+  if( _softSpi ) {
+    _fastWrite(SOFT_CS, LOW); 
+    return; 
+  }
+
+  _spiPort->beginTransaction(mySpiSettings); 
+  digitalWrite(_cs, LOW); 
+}
+
+// Deselects the sensor and ends the SPI transaction. According to datsheet,
+// the chip select must be written HIGH, LOW, HIGH to correctly end a READ
+// command. 
+void SparkFun_AS3935::_spiDeselect(bool _read)
+{
+  if( _softSpi ) {
+    _fastWrite(SOFT_CS, HIGH); 
+    if( _read ) {
+      _fastWrite(SOFT_CS, LOW); 
+      _fastWrite(SOFT_CS, HIGH); 
+    }
+    return; 
+  }
+
+  digitalWrite(_cs, HIGH); 
+  if( _read ) {
     digitalWrite(_cs, LOW); 
     digitalWrite(_cs, HIGH); 
-    _spiPort->endTransaction();
-    return(_regValue); 
   }
-  else {
-    _i2cPort->beginTransmission(_address); 
-    _i2cPort->write(_reg); // Moves pointer to register.
-    _i2cPort->endTransmission(false); // 'False' here sends a restart message so that bus is not released
-    _i2cPort->requestFrom(_address, 1); // Read the register, only ever once. 
-    _regValue = _i2cPort->read();
-    return(_regValue);
+  _spiPort->endTransaction();
+}
+
+// Transfers one byte over hardware or bit-banged SPI. The bit-banged
+// transfer is SPI mode 1, MSB first, like mySpiSettings: the clock idles LOW,
+// data is set up on the rising edge and sampled on the falling edge. 
+uint8_t SparkFun_AS3935::_spiTransfer(uint8_t _data)
+{
+  if( !_softSpi )
+    return _spiPort->transfer(_data); 
+
+  uint8_t _in = 0; 
+  for( uint8_t bit = 0x80; bit; bit >>= 1 ) {
+    _fastWrite(SOFT_SCK, HIGH); 
+    _fastWrite(SOFT_MOSI, (_data & bit) ? HIGH : LOW); 
+    if( _softHalfUs )
+      delayMicroseconds(_softHalfUs); 
+    _fastWrite(SOFT_SCK, LOW); 
+    if( _fastRead() )
+      _in |= bit; 
+    if( _softHalfUs )
+      delayMicroseconds(_softHalfUs); 
   }
+  return _in; 
+}
+
+// Pin writes and reads for the bit-banged SPI pins. Where the core gives
+// access to the port registers the pin's register and bit mask are looked
+// up once in beginSoftSPI() and used directly, otherwise this falls back
+// to digitalWrite() and digitalRead(). 
+void SparkFun_AS3935::_fastWrite(uint8_t _slot, uint8_t _state)
+{
+#ifdef AS3935_FAST_IO
+  // A read-modify-write of the whole port, an interrupt handler writing to
+  // the same port in between would have its change undone. digitalWrite()
+  // turns interrupts off around it for the same reason. 
+#ifdef __AVR__
+  uint8_t sreg = SREG; 
+  cli(); 
+#else
+  noInterrupts(); 
+#endif
+  if( _state )
+    *_softOut[_slot] |= _softMask[_slot]; 
+  else
+    *_softOut[_slot] &= ~_softMask[_slot]; 
+#ifdef __AVR__
+  SREG = sreg; 
+#else
+  interrupts(); 
+#endif
+#else
+  digitalWrite(_softPin[_slot], _state); 
+#endif
+}
+
+bool SparkFun_AS3935::_fastRead()
+{
+#ifdef AS3935_FAST_IO
+  return (*_softIn & _softInMask) != 0; 
+#else
+  return digitalRead(_softPin[SOFT_MISO]) == HIGH; 
+#endif
 }
@@ -4,6 +4,7 @@
 #include <Wire.h>
 #include <SPI.h>
 #include <Arduino.h>
+#include "SparkFun_AS3935_Trace.h"
 
 
 
@@ -55,6 +56,19 @@ enum SF_AS3935_REGSTER_MASKS {
 
 };
 
+// Settings presets for applyPreset().
+enum SF_AS3935_PRESETS {
+
+  PRESET_DEFAULT          = 0x00, // Manufacturer defaults.
+  PRESET_INDOOR_SENSITIVE,        // Lowest noise floor, watchdog and spike rejection.
+  PRESET_INDOOR_NOISY,            // Raised thresholds, disturbers masked.
+  PRESET_OUTDOOR,                 // Outdoor gain, default thresholds.
+  PRESET_OUTDOOR_SENSITIVE,       // Outdoor gain, lowest thresholds.
+  PRESET_OUTDOOR_INDUSTRIAL,      // Outdoor gain, high thresholds, five strikes per IRQ.
+  PRESET_COUNT
+
+};
+
 typedef enum INTERRUPT_STATUS {
 
   NOISE_TO_HIGH     = 0x01,
@@ -63,8 +77,35 @@ typedef enum INTERRUPT_STATUS {
 
 } lightningStatus;  
 
+// A single event read from the IC by pollEvent(). 
+typedef struct LIGHTNING_EVENT {
+
+  uint8_t type;        // Interrupt register value, see lightningStatus.
+  uint8_t distance;    // Distance to the storm in km, LIGHTNING only.
+  uint32_t energy;     // 20 bit 'energy' of the strike, LIGHTNING only.
+  uint32_t timestamp;  // millis() when the event was read.
+  uint16_t sequence;   // Per sensor event number, see eventSequence().
+
+} lightningEvent;
+
 #define INDOOR            0x12
 #define OUTDOOR           0xE
+#define GAIN_MAX          0x1F
+
+// Cores where the bit-banged SPI pins can be driven through their port
+// registers rather than digitalWrite(). 
+#if defined(__AVR__)
+#define AS3935_FAST_IO
+typedef uint8_t as3935Port_t; 
+#elif defined(ARDUINO_ARCH_SAMD)
+#define AS3935_FAST_IO
+typedef uint32_t as3935Port_t; 
+#endif
+
+// Most events that sleepService() holds for the upload hook. 
+#ifndef AS3935_BATCH_MAX
+#define AS3935_BATCH_MAX  8
+#endif
 
 #define DIRECT_COMMAND    0x96
 #define UNKNOWN_ERROR     0xFF
@@ -79,11 +120,31 @@ class SparkFun_AS3935
     SparkFun_AS3935(i2cAddress address);
 
     // I-squared-C Begin
-    bool begin(TwoWire &wirePort = Wire);
+    // By default the bus clock is left as the sketch set it, and as its rate
+    // isn't known link fallback stays off. Give i2cSpeed as 100000 or lower to
+    // have the clock set to it, or as 400000 (Fast-mode) or 1000000 (Fast-mode
+    // Plus) to have the clock raised: each rate from the requested one down to
+    // 100kHz is checked with burst reads of REG0x00-REG0x08 against a read at
+    // 100kHz and the first that reads back correctly is kept. 
+    bool begin(TwoWire &wirePort = Wire, uint32_t i2cSpeed = 0);
 
     // SPI begin 
     bool beginSPI(uint8_t user_CSPin, uint32_t spiPortSpeed = 1000000, SPIClass &spiPort = SPI); 
 
+    // Bit-banged SPI begin, for boards where the sensor isn't wired to a
+    // hardware SPI peripheral. Transfers are SPI mode 1, MSB first, like the
+    // hardware SPI settings. On AVR and SAMD the pins are driven through
+    // their port registers. At 1MHz and above no delay is added between clock
+    // edges and the rate is whatever the processor can manage. 
+    bool beginSoftSPI(uint8_t user_CSPin, uint8_t sckPin, uint8_t mosiPin, uint8_t misoPin, uint32_t spiPortSpeed = 1000000); 
+
+    // Software I-squared-C begin, to be used with the address constructor.
+    // Every phase of a transaction, including waiting out clock stretching,
+    // gives up after timeoutUs so that a locked up bus fails the transaction
+    // instead of hanging the sketch. Register reads use a repeated start and
+    // stay a single bus transaction. SDA and SCL need pull up resistors. 
+    bool beginSoftI2C(uint8_t sdaPin, uint8_t sclPin, uint32_t i2cSpeed = 100000, uint16_t timeoutUs = 1000); 
+
     // REG0x00, bit[0], manufacturer default: 0. 
     // The product consumes 1-2uA while powered down. If the board is powered down 
     // the the TRCO will need to be recalibrated: REG0x08[5] = 1, wait 2 ms, REG0x08[5] = 0.
@@ -104,7 +165,29 @@ class SparkFun_AS3935
 
     // REG0x00, bits [5:1], manufacturer default: 10010 (INDOOR). 
     // This function returns the indoor/outdoor settting. 
-    uint8_t readIndoorOutdoor();
+    uint8_t readIndoorOutdoor() { return (_registerImage(AFE_GAIN) & ~GAIN_MASK) >> 1; }
+
+    // REG0x00, bits [5:1], manufacturer default: 10010 (INDOOR). 
+    // This function sets the full five bit AFE gain (0-31) rather than just
+    // the INDOOR and OUTDOOR presets. Higher values are more sensitive. The
+    // current value can be read back with readIndoorOutdoor(). 
+    void setGain(uint8_t _gain);
+
+    // The auto ranging gain controller steps the AFE gain one value at a time
+    // between these limits. It steps down when a window sees any noise (INT_NH),
+    // or more disturbers than _disturbLimit and no lightning, and steps up when
+    // a window sees no disturbers or noise at all. Disturbers alone don't lower
+    // the gain while lightning is still being detected. 
+    void autoGainLimits(uint8_t _minGain, uint8_t _maxGain, uint8_t _disturbLimit = 10);
+
+    // Sets the length of the window that the auto ranging gain controller
+    // counts events over before deciding on a gain step, default is one minute.
+    void autoGainWindow(uint32_t _windowMs);
+
+    // Give this function the value returned by readInterruptReg() after every
+    // event, and call it with zero periodically so that quiet windows are
+    // also seen. Returns the AFE gain that is currently set. 
+    uint8_t autoRangeGain(uint8_t _intVal);
 
     // REG0x01, bits[3:0], manufacturer default: 0010 (2). 
     // This setting determines the threshold for events that trigger the 
@@ -114,7 +197,7 @@ class SparkFun_AS3935
     // REG0x01, bits[3:0], manufacturer default: 0010 (2). 
     // This function returns the threshold for events that trigger the 
     // IRQ Pin.  
-    uint8_t readWatchdogThreshold();
+    uint8_t readWatchdogThreshold() { return _registerImage(THRESHOLD) & ~THRESH_MASK; }
 
     // REG0x01, bits [6:4], manufacturer default: 010 (2).
     // The noise floor level is compared to a known reference voltage. If this
@@ -125,7 +208,17 @@ class SparkFun_AS3935
 
     // REG0x01, bits [6:4], manufacturer default: 010 (2).
     // This function will return the set noise level threshold: default is 2.
-    uint8_t readNoiseLevel();
+    uint8_t readNoiseLevel() { return (_registerImage(THRESHOLD) & ~NOISE_FLOOR_MASK) >> 4; }
+
+    // Measures how noisy the site is. Finds the lowest noise floor level (1-7)
+    // that doesn't raise INT_NH with a binary search, watching each level for
+    // _dwellMs but moving on as soon as INT_NH shows, and then puts the old
+    // level back. Returns zero if even level 7 is too noisy. Any lightning or
+    // disturber event during the measurement is read and dropped, it still
+    // takes a sequence number so the loss shows up as a gap. The interrupt
+    // register is only polled while busAvailable(), so with a bus budget set
+    // a level is watched less often rather than for longer. 
+    uint8_t measureNoiseFloor(uint16_t _dwellMs = 500);
 
     // REG0x02, bits [3:0], manufacturer default: 0010 (2).
     // This setting, like the watchdog threshold, can help determine between false
@@ -139,7 +232,7 @@ class SparkFun_AS3935
     // helps to differentiate between events and acutal lightning, by analyzing the 
     // shape of the spike during  chip's signal validation routine. 
     // Increasing this value increases robustness at the cost of sensitivity to distant events. 
-    uint8_t readSpikeRejection();
+    uint8_t readSpikeRejection() { return _registerImage(LIGHTNING_REG) & ~SPIKE_MASK; }
 
     // REG0x02, bits [5:4], manufacturer default: 0 (single lightning strike).
     // The number of lightning events before IRQ is set high. 15 minutes is The 
@@ -150,7 +243,31 @@ class SparkFun_AS3935
     // REG0x02, bits [5:4], manufacturer default: 0 (single lightning strike).
     // This function will return the number of lightning strikes must strike within
     // a 15 minute window before it triggers an event on the IRQ pin. Default is 1. 
-    uint8_t readLightningThreshold();
+    // The two bits map to 1, 5, 9 and 16 strikes. 
+    uint8_t readLightningThreshold() { uint8_t _bits = (_registerImage(LIGHTNING_REG) & ~LIGHT_MASK) >> 4; return (_bits == 3) ? 16 : (_bits * 4) + 1; }
+
+    // Load shedding uses the lightning threshold above as a hardware strike
+    // aggregator. When more than _maxIrqPerMin lightning interrupts arrive in
+    // a minute the threshold is raised to 5, then 9, then 16, and the strike
+    // statistics are cleared after every lightning interrupt so that each one
+    // stands for that many strikes. Once the estimated strike rate falls below
+    // half of _maxIrqPerMin the threshold steps back down towards 1. Disabling
+    // it restores a threshold of 1. 
+    void loadShedding(bool _enable, uint16_t _maxIrqPerMin = 30);
+
+    // Give this function the value returned by readInterruptReg() after every
+    // event, and call it with zero periodically so that a falling rate is seen. 
+    void shedLoad(uint8_t _intVal);
+
+    // Returns the number of lightning strikes seen since the last
+    // clearStrikeEstimate(). While the threshold is raised, strikes that
+    // were still below the threshold when the statistics were cleared or when
+    // they aged out of the 15 minute window are not counted, so this is a
+    // lower bound that may be short by up to 15 strikes per clear. 
+    uint32_t strikeEstimate() { return _lsStrikes; }
+
+    // Sets the strike estimate back to zero. 
+    void clearStrikeEstimate() { _lsStrikes = 0; }
 
     // REG0x02, bit [6], manufacturer default: 1. 
     // This register clears the number of lightning strikes that has been read in
@@ -167,13 +284,109 @@ class SparkFun_AS3935
     // disturber.  
     uint8_t readInterruptReg();
 
+    // Polling mode read of a complete event. Returns false when the chip has
+    // not latched anything, without reading the energy or distance registers,
+    // and also when the event is the same one as the last read: lightning
+    // with the same energy and distance within its one second read window, or
+    // INT_NH again within 1.5 seconds while the noise persists. Disturbers are
+    // never suppressed. Returns true and fills _event when there's a new
+    // event.  
+    bool pollEvent(lightningEvent &_event);
+
+    // Returns the number of events pollEvent() has suppressed as duplicates. 
+    uint16_t duplicatesSuppressed() { return _dupCount; }
+
+    // Non-blocking interrupt handling. Call irqEdge() from the IRQ pin's
+    // rising edge interrupt, it only stores the time. interruptReady() returns
+    // true once the 2ms the IC needs to populate the interrupt register have
+    // passed, and readInterruptRegNow() then reads it without waiting. 
+    void irqEdge();
+    bool interruptReady() { return _irqPending && (_irqAge() >= 2000); }
+    uint8_t readInterruptRegNow();
+
+    // Sleep hooks for battery powered nodes. _enterSleep is called with true
+    // for a light sleep, which must wake again within a millisecond or so (a
+    // timer tick will do), and with false for a deep sleep that only the IRQ
+    // pin needs to wake from. _exitSleep is called after either sleep. 
+    // The deep sleep is entered with interrupts disabled, so that an IRQ edge
+    // can't slip in between the check for a pending IRQ and the sleep: the
+    // hook must enable them in the same step as it sleeps, for example
+    // sei(); sleep_cpu(); on AVR, where the instruction after sei() always
+    // runs before any interrupt. 
+    void sleepHooks(void (*_enterSleep)(bool _light), void (*_exitSleep)());
+
+    // Events are collected and given to _upload _size at a time (up to
+    // AS3935_BATCH_MAX), so that a radio only has to be woken once per batch.
+    void uploadHook(void (*_upload)(const lightningEvent *_events, uint8_t _count), uint8_t _size = 1);
+
+    // Call this from loop() with irqEdge() attached to the IRQ pin. With no
+    // IRQ pending it deep sleeps until the IRQ wakes the processor. With one
+    // pending it light sleeps through the rest of the 2ms population wait,
+    // reads the event in one transaction (two for lightning), batches it for
+    // upload and returns true. 
+    bool sleepService();
+
+    // Gives any batched events to the upload hook now. 
+    void flushBatch();
+
+    // Returns the number of events waiting in the batch for upload, and the
+    // most that have waited at once. 
+    uint8_t batchDepth() { return _batchCount; }
+    uint8_t batchHighWater() { return _batchHighWater; }
+
+    // Returns the time in microseconds from the last IRQ edge to the end of
+    // its servicing by sleepService(), and the longest seen. 
+    uint32_t awakeTime() { return _awakeUs; }
+    uint32_t maxAwakeTime() { return _awakeMaxUs; }
+
+    // Loss accounting. Every event read from the interrupt register, by any
+    // of the functions above, gets the next number of a per sensor sequence
+    // that is carried in lightningEvent, so a gap anywhere downstream shows
+    // an event lost after it was read. eventSequence() returns the last
+    // number given out. The other counters place losses before that point:
+    // missedReadWindows() counts IRQs read after the IC's read window (one
+    // second for lightning, 1.5 otherwise), irqOverruns() counts IRQ edges
+    // that arrived before the previous one was read, and batchDrops() counts
+    // batched events discarded with no upload hook set. 
+    uint16_t eventSequence() { return _sequence; }
+    uint16_t missedReadWindows() { return _missedWindows; }
+    uint16_t irqOverruns() { return _irqOverruns; }
+    uint16_t batchDrops() { return _batchDrops; }
+
+    // Noise episode tracking. Because INT_NH persists for as long as the noise
+    // lasts, re-reading REG0x03 every time the IRQ pin is HIGH only returns the
+    // same NOISE_TO_HIGH flag again. Give trackNoise() the value returned by
+    // readInterruptReg(): an episode starts on the first NOISE_TO_HIGH and ends
+    // on the first read without it. 
+    void trackNoise(uint8_t _intVal);
+
+    // Give this function the state of the IRQ pin, it returns whether the
+    // interrupt register should be read. Outside of a noise episode that's
+    // whenever the pin is HIGH, during one it's once per noise poll interval
+    // regardless of the pin, so that the end of the episode is still seen. 
+    bool serviceDue(bool _irqPinHigh);
+
+    // Sets how often the interrupt register is read during a noise episode,
+    // default is once a second. 
+    void noisePollInterval(uint16_t _intervalMs);
+
+    // Returns true while a noise episode is active. 
+    bool noiseEpisodeActive() { return _nhActive; }
+
+    // Returns the length in milliseconds of the active noise episode, or of
+    // the last one if none is active. 
+    uint32_t noiseEpisodeDuration();
+
+    // Returns the number of noise episodes that have started. 
+    uint16_t noiseEpisodeCount() { return _nhCount; }
+
     // REG0x03, bit [5], manufacturere default: 0.
     // This setting will change whether or not disturbers trigger the IRQ Pin. 
     void maskDisturber(bool _state);
 
     // REG0x03, bit [5], manufacturere default: 0.
     // This setting will return whether or not disturbers trigger the IRQ Pin. 
-    uint8_t readMaskDisturber();
+    uint8_t readMaskDisturber() { return (_registerImage(INT_MASK_ANT) & ~DISTURB_MASK) >> 5; }
 
     // REG0x03, bit [7:6], manufacturer default: 0 (16 division ratio). 
     // The antenna is designed to resonate at 500kHz and so can be tuned with the
@@ -187,7 +400,7 @@ class SparkFun_AS3935
     // so when modifying the resonance frequency with the internal capacitors
     // (tuneCap()) it's important to keep in mind that the displayed frequency on
     // the IRQ pin is divided by this number. 
-    uint8_t readDivRatio();
+    uint8_t readDivRatio() { return 16 << ((_registerImage(INT_MASK_ANT) & ~DIV_MASK) >> 6); }
 
     // REG0x07, bit [5:0], manufacturer default: 0. 
     // This register holds the distance to the front of the storm and not the
@@ -210,7 +423,7 @@ class SparkFun_AS3935
     // This setting will return the capacitance of the internal capacitors. It will
     // return a value from one to 15 multiplied by the 8pF steps of the internal
     // capacitance.
-    uint8_t readTuneCap();
+    uint8_t readTuneCap() { return (_registerImage(FREQ_DISP_IRQ) & ~CAP_MASK) * 8; } //Multiplied by 8pF
 
     // LSB =  REG0x04, bits[7:0]
     // MSB =  REG0x05, bits[7:0]
@@ -219,6 +432,17 @@ class SparkFun_AS3935
     // According to the datasheet this is only a pure value that doesn't have any
     // physical meaning. 
     uint32_t lightningEnergy();
+
+    // Decoders for raw register values, defined here so that they inline
+    // into code that reads the registers itself, for example in a burst. 
+    // REG0x03, bits [3:0]: the interrupt value, see lightningStatus. 
+    static uint8_t decodeInterrupt(uint8_t _reg) { return _reg & INT_MASK; }
+    // REG0x04-REG0x06 in that order: the 20 bit lightning energy. 
+    static uint32_t decodeEnergy(const uint8_t *_regs) { 
+      return ((uint32_t)(_regs[2] & ENERGY_MASK) << 16) | ((uint32_t)_regs[1] << 8) | _regs[0]; 
+    }
+    // REG0x07, bits [5:0]: distance to the storm in km. 
+    static uint8_t decodeDistance(uint8_t _reg) { return _reg & DISTANCE_MASK; }
   
     // REG0x3D, bits[7:0]
     // This function calibrates both internal oscillators The oscillators are tuned
@@ -226,19 +450,252 @@ class SparkFun_AS3935
     // before the calibration is done. 
     bool calibrateOsc();
 
+    // Calibrates the oscillators of many sensors at once. The CALIB_RCO direct
+    // command is sent to every sensor back to back and a single 2ms wait
+    // covers them all, so waking a fleet costs about one calibration instead
+    // of one per sensor. Sensors that fail are retried, up to _retries times,
+    // and each sensor's outcome is written to _results if it's given. Returns
+    // true when every sensor calibrated. It doesn't wait for busAvailable(): a
+    // sensor isn't usable until it's calibrated, and it's a few transactions
+    // per sensor. 
+    static bool calibrateOscAll(SparkFun_AS3935 *_sensors[], uint8_t _count, bool *_results = NULL, uint8_t _retries = 2);
+
     // REG0x3C, bits[7:0]
     // This function resets all settings to their default values. 
     void resetSettings();
 
+    // REG0x00-REG0x03
+    // This function applies one of the settings presets in SF_AS3935_PRESETS
+    // (gain, noise floor, watchdog threshold, spike rejection, lightning
+    // threshold and disturber mask) with a single burst write. The presets
+    // are kept in program memory, and power down and the antenna division
+    // ratio are left alone.
+    void applyPreset(uint8_t _preset);
+
+    // Write verify mode. While enabled every register written by the setters
+    // above is remembered so that verifyWrites() can check them together. 
+    void writeVerify(bool _enable);
+
+    // Call after a group of setters. Reads back every register written since
+    // the last call in a single burst and compares them with what was written.
+    // Only the registers that don't match are written and read again, up to
+    // _retries times. Returns true when every register matches. When the bus
+    // budget is used up (see busAvailable()) nothing is read, false is
+    // returned and the writes stay pending for a later call. 
+    bool verifyWrites(uint8_t _retries = 2);
+
+    // Returns the number of registers verifyWrites() has had to write again. 
+    uint16_t verifyRetries() { return _verifyRetries; }
+
+    // Presence tracking. Call this periodically: while the sensor is connected
+    // it's probed once per probe interval, and once it has gone missing it's
+    // probed with an exponential backoff from 100ms up to a minute. When it
+    // answers again the configuration set through this library is restored
+    // and the oscillators are recalibrated. Returns whether the sensor is
+    // connected. The first call after a begin function always probes. Only
+    // the probes of a connected sensor wait for busAvailable(): bringing a
+    // lost sensor back, with its verify and calibration, never waits. 
+    bool checkConnection();
+
+    // Returns whether the sensor was connected at the last transaction or probe. 
+    // Three failed I-squared-C transactions in a row also mark it as missing. 
+    bool isConnected() { return _connected; }
+
+    // Sets how often checkConnection() probes a connected sensor, default is
+    // every five seconds. 
+    void probeInterval(uint32_t _intervalMs);
+
+    // Returns the number of failed I-squared-C transactions. 
+    uint16_t transactionErrors() { return _txErrors; }
+
+    // Returns the number of times the sensor has been brought back after going
+    // missing. 
+    uint16_t reconnectCount() { return _reconnects; }
+
+    // Bus utilisation governor. Limits the share of bus time this library
+    // spends on work that can wait, as a percentage of each window (default
+    // one second). 100, the default, disables the governor. 
+    void busBudget(uint8_t _percent, uint32_t _windowMs = 1000);
+
+    // Returns false when the current window has already used up its budget.
+    // Connection probes of a healthy sensor, auto ranging gain steps,
+    // verifyWrites() and the polling of measureNoiseFloor() are deferred
+    // until this returns true. Reads of the interrupt register, energy and
+    // distance never are, nor are reconnection and oscillator calibration.
+    // Sketches can check it before their own non-critical reads. 
+    bool busAvailable();
+
+    // Returns the percentage of the last complete window the bus was busy
+    // with this library's transactions. 
+    uint8_t busUtilization() { return _busUtil; }
+
+    // Returns the total number of register transactions and the total time
+    // in microseconds the bus was busy with them, for benchmarking. 
+    uint32_t transactionCount() { return _txCount; }
+    uint32_t busTime() { return _busTotalUs; }
+
+    // Link rate fallback. When enabled the bus clock steps down one rate when
+    // five or more of a hundred transactions fail, and back up one rate after
+    // ten error free windows, never above the rate given to begin() or
+    // beginSPI(). SPI rates are 2MHz, 1MHz, 250kHz and 100kHz, skipping the
+    // antenna's 500kHz, and I-squared-C rates are 1MHz, 400kHz, 100kHz and 50kHz.
+    // SPI has no acknowledge so only probes count on SPI: the windows there
+    // are ten probes long and two failed probes step the clock down. On
+    // I-squared-C it only runs when begin() was given a rate. 
+    void linkFallback(bool _enable);
+
+    // Returns the current bus clock rate in Hz, zero if begin() left the
+    // I-squared-C clock as the sketch set it. 
+    uint32_t linkSpeed() { return _linkSpeed; }
+
+    // Returns the number of software I-squared-C transactions that timed out. 
+    uint16_t busTimeouts() { return _swTimeouts; }
+
+    // Returns the number of times the link has stepped down. 
+    uint16_t linkDownshifts() { return _linkDown; }
+
+    // Returns the number of times the link has stepped back up. 
+    uint16_t linkUpshifts() { return _linkUp; }
+
   private:
 
     uint32_t _spiPortSpeed; // Given sport speed. 
     uint8_t _cs; // Chip select pin
     uint8_t _regValue; // Variable for returned register data. 
-    uint8_t _spiWrite; // Variable used for SPI write commands. 
-    uint8_t _i2cWrite; // Variable used for SPI write commands. 
+
+    // Last known images of REG0x00-REG0x08 so that a setter doesn't need to
+    // read the register before writing it. One valid bit per register. 
+    uint8_t _shadowReg[FREQ_DISP_IRQ + 1];
+    uint16_t _shadowValid; 
+
+    // Auto ranging gain state.
+    uint8_t _agMinGain;
+    uint8_t _agMaxGain;
+    uint8_t _agDisturbLimit; 
+    uint32_t _agWindowMs;
+    uint32_t _agWindowStart; 
+    uint8_t _agNoise; 
+    uint8_t _agDisturber; 
+    uint8_t _agLightning; 
+
+    // Load shedding state.
+    bool _lsEnabled; 
+    uint16_t _lsMaxIrq; 
+    uint8_t _lsLevel; // Index into the 1, 5, 9, 16 strike thresholds.
+    uint16_t _lsIrqCount; 
+    uint32_t _lsWindowStrikes; 
+    uint32_t _lsWindowStart; 
+    uint32_t _lsStrikes; 
+    // Last event returned by pollEvent() and the duplicates suppressed. 
+    lightningEvent _lastEvent; 
+    uint16_t _dupCount; 
+
+    // Non-blocking interrupt and sleep state. 
+    volatile bool _irqPending; 
+    volatile uint32_t _irqTime; 
+    void (*_sleepEnter)(bool _light); 
+    void (*_sleepExit)(); 
+    void (*_uploadFn)(const lightningEvent *_events, uint8_t _count); 
+    lightningEvent _batch[AS3935_BATCH_MAX]; 
+    uint8_t _batchSize; 
+    uint8_t _batchCount; 
+    uint8_t _batchHighWater; 
+    uint32_t _awakeUs; 
+    uint32_t _awakeMaxUs; 
+
+    // Loss accounting state. 
+    uint16_t _sequence; 
+    uint16_t _missedWindows; 
+    volatile uint16_t _irqOverruns; 
+    uint16_t _batchDrops; 
+    // Reads the interrupt register, numbering events and checking the window.
+    uint8_t _readInterrupt();
+    // Takes the pending IRQ edge, with interrupts off, before REG0x03 is read.
+    bool _takeIrq(uint32_t &_age);
+    // The accounting of a read of REG0x03, also when part of a longer burst. 
+    uint8_t _countInterrupt(uint8_t _interValue, bool _pending, uint32_t _age);
+    // Reads a complete event in as few transactions as possible. 
+    bool _readEvent(lightningEvent &_event);
+
+    // Noise episode state.
+    bool _nhActive; 
+    uint16_t _nhPollMs; 
+    uint16_t _nhCount; 
+    uint32_t _nhStart; 
+    uint32_t _nhDuration; 
+    uint32_t _nhLastPoll; 
+
+    // Write verify state, one pending bit per register in _shadowReg. 
+    bool _verify; 
+    uint16_t _verifyPending; 
+    uint16_t _verifyRetries; 
+
+    // Presence tracking state. 
+    bool _connected; 
+    uint32_t _txCount; 
+    uint16_t _txErrors; 
+    uint8_t _failRun; // Failed transactions in a row.
+    uint32_t _probeMs; 
+    uint32_t _backoffMs; 
+    uint32_t _lastProbe; 
+    uint16_t _reconnects; 
+    // Bus governor state. 
+    uint8_t _busBudget; 
+    uint8_t _busUtil; 
+    uint32_t _busWindowMs; 
+    uint32_t _busWindowStart; 
+    uint32_t _busBusyUs; 
+    uint32_t _busTotalUs; 
+    // Adds the time since _start to the bus busy time. 
+    void _busTime(uint32_t _start);
+
+    // Link rate fallback state. 
+    bool _linkFallback; 
+    uint32_t _linkSpeed; 
+    uint32_t _linkCeiling; // Rate given to begin() or beginSPI(). 
+    uint8_t _linkTx; 
+    uint8_t _linkErr; 
+    uint8_t _linkClean; // Error free windows in a row. 
+    uint16_t _linkDown; 
+    uint16_t _linkUp; 
+    // Counts a transaction towards the link quality window.
+    void _linkQuality(bool _ok);
+    // Steps the I-squared-C clock up to the requested rate, checking it.
+    void _negotiateClock(uint32_t _speed);
+    // Sets the clock rate of the bus the sensor is on. 
+    void _setLinkSpeed(uint32_t _speed);
+
+    // Records the result of a transaction.
+    void _transaction(bool _ok);
+    // A lightweight check that the sensor is there. 
+    bool _probe();
+    // Writes the shadowed configuration back to a sensor that has lost it.
+    void _restoreConfig();
+
+    // Applies the threshold for the given load shedding level.
+    void _shedLevel(uint8_t _level);
 
     SPISettings mySpiSettings; 
+
+    // Bit-banged SPI pins, and their port registers where available. 
+    enum { SOFT_CS = 0, SOFT_SCK, SOFT_MOSI, SOFT_MISO }; 
+    bool _softSpi; 
+    uint8_t _softPin[4]; 
+    uint16_t _softHalfUs; // Half clock period. 
+
+    // Software I-squared-C pins and state. 
+    bool _softI2c; 
+    uint8_t _sda; 
+    uint8_t _scl; 
+    uint16_t _swTimeoutUs; 
+    bool _swFault; 
+    uint16_t _swTimeouts; 
+#ifdef AS3935_FAST_IO
+    volatile as3935Port_t *_softOut[3]; // CS, SCK, MOSI 
+    as3935Port_t _softMask[3]; 
+    volatile as3935Port_t *_softIn; // MISO
+    as3935Port_t _softInMask; 
+#endif
     
     // Address variable. 
     i2cAddress _address; 
@@ -247,8 +704,50 @@ class SparkFun_AS3935
     // setting, and then write the given bits to the register at the given
     // start position. 
     void _writeRegister(uint8_t _reg, uint8_t _mask, uint8_t _bits, uint8_t _startPosition);
+    // Writes a whole byte to the given register. 
+    void _writeByte(uint8_t _reg, uint8_t _value);
+    // Writes _len registers in one burst starting at the given register.
+    // Returns false if the transaction failed. 
+    bool _writeRegisters(uint8_t _reg, const uint8_t *_values, uint8_t _len);
+    // Gets the current image of the given register, from the shadow if it's
+    // valid or from the IC if it's not. Returns false if the read failed. 
+    bool _currentRegister(uint8_t _reg, uint8_t &_value);
+    // Register image for the settings getters: the shadow when it's valid,
+    // otherwise _fetchRegister() reads the IC. Zero if that read fails. 
+    uint8_t _registerImage(uint8_t _reg) { return (_shadowValid & (1 << _reg)) ? _shadowReg[_reg] : _fetchRegister(_reg); }
+    uint8_t _fetchRegister(uint8_t _reg);
+    // verifyWrites() without the bus budget check. 
+    bool _verifyWrites(uint8_t _retries);
+    // Oscillator calibration steps, split so many sensors can share the wait. 
+    void _calibStart();
+    bool _calibCheck();
+    // Sets the library's state variables to their defaults, called by both
+    // constructors. 
+    void _setDefaults();
     // Reads the given register.
     uint8_t _readRegister(uint8_t _reg);
+    // Reads _len registers in one burst starting at the given register.
+    bool _readRegisters(uint8_t _reg, uint8_t *_buf, uint8_t _len);
+    // SPI transaction helpers, shared by hardware and bit-banged SPI. 
+    void _spiSelect();
+    void _spiDeselect(bool _read);
+    uint8_t _spiTransfer(uint8_t _data);
+    // Software I-squared-C bus conditions and bytes. 
+    bool _swWait(uint8_t _pin);
+    void _swLine(uint8_t _pin, bool _high);
+    bool _swStart();
+    bool _swRestart();
+    bool _swStop();
+    bool _swWrite(uint8_t _data);
+    uint8_t _swRead(bool _ack);
+    // True for hardware and bit-banged SPI. 
+    bool _usingSpi() { return (_i2cPort == NULL) && !_softI2c; }
+    // Microseconds since the last IRQ edge. The time is copied with
+    // interrupts off as irqEdge() may be writing it. 
+    uint32_t _irqAge() { noInterrupts(); uint32_t _time = _irqTime; interrupts(); return micros() - _time; }
+    // Pin access for bit-banged SPI. 
+    void _fastWrite(uint8_t _slot, uint8_t _state);
+    bool _fastRead();
     // I-squared-C and SPI Classes
     TwoWire *_i2cPort; 
     SPIClass *_spiPort; 
@@ -0,0 +1,146 @@
+#ifndef _SPARKFUN_AS3935_HEAPGUARD_H_
+#define _SPARKFUN_AS3935_HEAPGUARD_H_
+
+#include <Arduino.h>
+#include <stdlib.h>
+#ifdef __AVR__
+#include <new.h>
+#else
+#include <new>
+#endif
+#ifdef __arm__
+#include <malloc.h>
+#endif
+
+// Checks that a stretch of code, like servicing an IRQ from reading the
+// interrupt register through the pipeline, doesn't allocate.
+//
+//    #include "SparkFun_AS3935_HeapGuard.h"
+//
+//    AS3935HeapGuard guard;
+//    if( lightning.pollEvent(event) )
+//      pipeline.process(event);
+//    if( guard.allocated() )
+//      Serial.println("The hot path allocated memory!");
+//
+// This header replaces the global operator new and delete with ones that
+// count every allocation, so include it in one file of a sketch only. A
+// guard fails on any new made while it's active, even one that was deleted
+// again before allocated() is called. Calls straight to malloc(), like the
+// String class makes, aren't counted: those are seen when they change the
+// heap top or free list on AVR, or the bytes in use on ARM, and a block
+// that was freed again in between is missed.
+
+// Allocations made through operator new since the sketch started.
+inline volatile uint32_t &as3935HeapAllocations()
+{
+  static volatile uint32_t allocations = 0;
+  return allocations;
+}
+
+// Counts the allocation with interrupts off, putting them back the way they
+// were as operator new may be called with them off already.
+inline void *as3935HeapAllocate(size_t _size)
+{
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  cli();
+  as3935HeapAllocations()++;
+  SREG = sreg;
+#else
+  noInterrupts();
+  as3935HeapAllocations()++;
+  interrupts();
+#endif
+  return malloc(_size);
+}
+
+void *operator new(size_t _size) { return as3935HeapAllocate(_size); }
+void *operator new[](size_t _size) { return as3935HeapAllocate(_size); }
+void operator delete(void *_block) noexcept { free(_block); }
+void operator delete[](void *_block) noexcept { free(_block); }
+#if __cpp_sized_deallocation
+void operator delete(void *_block, size_t) noexcept { free(_block); }
+void operator delete[](void *_block, size_t) noexcept { free(_block); }
+#endif
+
+#ifdef __AVR__
+// avr-libc's heap top and free list head.
+extern "C" {
+  extern char *__brkval;
+  extern void *__flp;
+}
+#endif
+
+class AS3935HeapGuard
+{
+  public:
+    AS3935HeapGuard() { start(); }
+
+    // Starts counting again from now.
+    void start()
+    {
+      _allocations = _count();
+#if defined(__AVR__)
+      _top = __brkval;
+      _free = __flp;
+#elif defined(__arm__)
+      _inUse = (size_t)mallinfo().uordblks;
+#endif
+    }
+
+    // Returns the number of times operator new was called since start().
+    uint32_t allocations() const { return _count() - _allocations; }
+
+    // Returns true if anything was allocated since start().
+    bool allocated() const
+    {
+      if( allocations() != 0 )
+        return true;
+#if defined(__AVR__)
+      return (__brkval != _top) || (__flp != _free);
+#elif defined(__arm__)
+      return (size_t)mallinfo().uordblks != _inUse;
+#else
+      return false;
+#endif
+    }
+
+    // Returns true if calls straight to malloc() are checked as well, see
+    // above.
+    static bool checksMalloc()
+    {
+#if defined(__AVR__) || defined(__arm__)
+      return true;
+#else
+      return false;
+#endif
+    }
+
+  private:
+    // The count is copied with interrupts off as a 32 bit read isn't atomic
+    // on 8 bit processors.
+    static uint32_t _count()
+    {
+#ifdef __AVR__
+      uint8_t sreg = SREG;
+      cli();
+      uint32_t count = as3935HeapAllocations();
+      SREG = sreg;
+#else
+      noInterrupts();
+      uint32_t count = as3935HeapAllocations();
+      interrupts();
+#endif
+      return count;
+    }
+
+    uint32_t _allocations;
+#if defined(__AVR__)
+    char *_top;
+    void *_free;
+#elif defined(__arm__)
+    size_t _inUse;
+#endif
+};
+#endif
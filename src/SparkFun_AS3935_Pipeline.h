@@ -0,0 +1,123 @@
+#ifndef _SPARKFUN_AS3935_PIPELINE_H_
+#define _SPARKFUN_AS3935_PIPELINE_H_
+
+#include "SparkFun_AS3935.h"
+
+// A pipeline of stages that events read from the lightning detector are
+// passed through, for example classification, tracking, alerting and then
+// logging. The stages are given as types and put together at compile time:
+// there's no virtual dispatch and nothing is allocated, each stage is simply
+// a member of the pipeline. A stage is any class with a method
+//
+//    bool process(lightningEvent &_event);
+//
+// that returns false to drop the event, in which case later stages don't see
+// it. For example:
+//
+//    AS3935Pipeline<DropDisturbers, StormTracker, SerialLogger> pipeline;
+//    lightningEvent event;
+//    if( lightning.pollEvent(event) )
+//      pipeline.process(event);
+
+// Uncomment, or define before including this file, to also time every
+// stage. It costs two calls to micros() per stage per event, and leaves the
+// time counters at zero when it's off.
+//#define AS3935_PIPELINE_PROFILE
+
+// Counters kept for every stage.
+typedef struct PIPELINE_STAGE_STATS {
+
+  uint32_t in;   // Events given to the stage.
+  uint32_t out;  // Events the stage passed on.
+  uint32_t gaps; // Sequence numbers skipped between events reaching the stage.
+  uint32_t totalUs; // Time spent in the stage, in microseconds.
+  uint32_t maxUs;   // Longest the stage took with a single event.
+
+} pipelineStageStats;
+
+template <typename... Stages> class AS3935Pipeline;
+
+// The end of the pipeline.
+template <> class AS3935Pipeline<>
+{
+  public:
+    static const uint8_t stageCount = 0;
+
+    bool process(lightningEvent &, uint8_t = 0) { return true; }
+
+    pipelineStageStats stats(uint8_t) const
+    {
+      pipelineStageStats none = { 0, 0, 0, 0, 0 };
+      return none;
+    }
+
+    void clearStats() { }
+};
+
+template <typename First, typename... Rest> class AS3935Pipeline<First, Rest...>
+{
+  public:
+    static const uint8_t stageCount = 1 + sizeof...(Rest);
+
+    AS3935Pipeline() { clearStats(); }
+
+    // Passes the event through every stage in order. Returns false if a
+    // stage dropped it. _index is this stage's position, for tracing.
+    bool process(lightningEvent &_event, uint8_t _index = 0)
+    {
+      // Events dropped by earlier stages show up here as gaps too, so gaps
+      // beyond the previous stage's in minus out are events lost on the way.
+      if( _stats.in != 0 )
+        _stats.gaps += (uint16_t)(_event.sequence - _lastSequence - 1);
+      _lastSequence = _event.sequence;
+      _stats.in++;
+      AS3935_TRACE_BEGIN(TRACE_STAGE, _index);
+#ifdef AS3935_PIPELINE_PROFILE
+      uint32_t start = micros();
+      bool passed = _stage.process(_event);
+      uint32_t took = micros() - start;
+      _stats.totalUs += took;
+      if( took > _stats.maxUs )
+        _stats.maxUs = took;
+#else
+      bool passed = _stage.process(_event);
+#endif
+      AS3935_TRACE_END(TRACE_STAGE, _index);
+      if( !passed )
+        return false;
+      _stats.out++;
+      return _rest.process(_event, _index + 1);
+    }
+
+    // The first stage, and the pipeline of the stages after it, so that every
+    // stage can be reached: pipeline.rest().stage() is the second one.
+    First &stage() { return _stage; }
+    AS3935Pipeline<Rest...> &rest() { return _rest; }
+
+    // Returns the counters of the stage at _index, zero being the first.
+    pipelineStageStats stats(uint8_t _index) const
+    {
+      if( _index == 0 )
+        return _stats;
+      return _rest.stats(_index - 1);
+    }
+
+    // Sets every stage's counters back to zero.
+    void clearStats()
+    {
+      _stats.in = 0;
+      _stats.out = 0;
+      _stats.gaps = 0;
+      _stats.totalUs = 0;
+      _stats.maxUs = 0;
+      _lastSequence = 0;
+      _rest.clearStats();
+    }
+
+  private:
+    First _stage;
+    pipelineStageStats _stats;
+    uint16_t _lastSequence;
+    AS3935Pipeline<Rest...> _rest;
+};
+#endif
@@ -0,0 +1,149 @@
+#ifndef _SPARKFUN_AS3935_POOL_H_
+#define _SPARKFUN_AS3935_POOL_H_
+
+#include <Arduino.h>
+#ifdef __AVR__
+#include <new.h>
+#else
+#include <new>
+#endif
+
+// A fixed block pool for objects whose lifetimes don't fit a simple queue,
+// like storm sessions, alert states or per sensor trackers, on processors
+// where malloc() isn't an option. Room for N objects of type T is reserved
+// inside the pool itself so its size is known at compile time, and both
+// alloc() and release() take the same time however full the pool is.
+//
+//    AS3935Pool<StormSession, 4> sessions;
+//    StormSession *session = sessions.alloc(); // NULL when the pool is full.
+//    ...
+//    sessions.release(session);
+template <typename T, uint8_t N> class AS3935Pool
+{
+  static_assert(N > 0, "An AS3935Pool needs room for at least one object");
+
+  public:
+    static const uint8_t capacity = N;
+
+    AS3935Pool() : _used(0), _highWater(0)
+    {
+      // Every block starts out on the free list.
+      for( uint8_t i = 0; i < N - 1; i++ )
+        _blocks[i].next = &_blocks[i + 1];
+      _blocks[N - 1].next = NULL;
+      _free = &_blocks[0];
+    }
+
+    // Takes a block off the free list and constructs a T in it. Returns NULL
+    // when every block is in use.
+    T *alloc()
+    {
+      if( _free == NULL )
+        return NULL;
+
+      Block *block = _free;
+      _free = block->next;
+      if( ++_used > _highWater )
+        _highWater = _used;
+      return new (block->storage) T();
+    }
+
+    // Destroys the object and puts its block back on the free list. The
+    // pointer must have come from alloc() on this pool.
+    void release(T *_object)
+    {
+      if( _object == NULL )
+        return;
+
+      _object->~T();
+      Block *block = reinterpret_cast<Block *>(_object);
+      block->next = _free;
+      _free = block;
+      _used--;
+    }
+
+    // Returns the number of objects in use.
+    uint8_t used() const { return _used; }
+
+    // Returns the most objects that have been in use at once, useful for
+    // sizing N.
+    uint8_t highWater() const { return _highWater; }
+
+  private:
+    union Block {
+      Block *next;
+      alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    Block _blocks[N];
+    Block *_free;
+    uint8_t _used;
+    uint8_t _highWater;
+};
+
+// A monotonic arena for work done a batch at a time, for example decoding,
+// enriching and formatting the events handed to an upload hook. Allocation
+// only moves a pointer forward and nothing is freed on its own: reset() at
+// the end of the batch frees everything at once.
+//
+//    AS3935Arena<256> arena;
+//    void upload(const lightningEvent *events, uint8_t count)
+//    {
+//      char *line = (char *)arena.alloc(32);
+//      ...
+//      arena.reset();
+//    }
+template <uint16_t Bytes> class AS3935Arena
+{
+  static_assert(Bytes > 0, "An AS3935Arena needs at least one byte");
+
+  public:
+    static const uint16_t capacity = Bytes;
+
+    AS3935Arena() : _used(0), _highWater(0), _allocs(0) { }
+
+    // Returns _size bytes aligned to _align, which must be a power of two, or
+    // NULL if the arena doesn't have room left.
+    void *alloc(uint16_t _size, uint8_t _align = sizeof(void *))
+    {
+      uintptr_t start = (reinterpret_cast<uintptr_t>(_buffer) + _used + (_align - 1)) & ~(uintptr_t)(_align - 1);
+      uint16_t offset = start - reinterpret_cast<uintptr_t>(_buffer);
+      if( (offset > Bytes) || (_size > (Bytes - offset)) )
+        return NULL;
+
+      _used = offset + _size;
+      if( _used > _highWater )
+        _highWater = _used;
+      _allocs++;
+      return _buffer + offset;
+    }
+
+    // Constructs a T in the arena. Its destructor is never run, so keep to
+    // types that don't need one.
+    template <typename T> T *make()
+    {
+      void *block = alloc(sizeof(T), alignof(T));
+      return (block == NULL) ? NULL : new (block) T();
+    }
+
+    // Frees everything allocated since the last reset. 
+    void reset()
+    {
+      _used = 0;
+      _allocs = 0;
+    }
+
+    // Returns the bytes in use, the most ever in use at once, and the number
+    // of allocations since the last reset.
+    uint16_t used() const { return _used; }
+    uint16_t highWater() const { return _highWater; }
+    uint16_t allocations() const { return _allocs; }
+
+  private:
+    alignas(void *) unsigned char _buffer[Bytes];
+    uint16_t _used;
+    uint16_t _highWater;
+    uint16_t _allocs;
+};
+
+#endif
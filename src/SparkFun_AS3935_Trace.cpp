@@ -0,0 +1,41 @@
+/*
+  Trace recorder for the AS3935 Lightning Detector library, see
+  SparkFun_AS3935_Trace.h. 
+*/
+
+#include "SparkFun_AS3935_Trace.h"
+
+#ifdef AS3935_TRACE
+
+as3935TraceRecord as3935TraceRing[AS3935_TRACE_SIZE];
+volatile uint8_t as3935TraceHead = 0;
+volatile bool as3935TraceWrapped = false;
+
+// Prints the ring oldest record first and empties it. Records traced while
+// it prints are dropped. 
+void as3935TraceDump(Print &_out)
+{
+  noInterrupts(); 
+  uint8_t count = as3935TraceWrapped ? AS3935_TRACE_SIZE : as3935TraceHead; 
+  uint8_t index = as3935TraceWrapped ? as3935TraceHead : 0; 
+  interrupts(); 
+
+  for( uint8_t i = 0; i < count; i++ ) {
+    const as3935TraceRecord &record = as3935TraceRing[index]; 
+    _out.print("AS3935T "); 
+    _out.print(record.time, HEX); 
+    _out.print(" "); 
+    _out.print(record.event, HEX); 
+    _out.print(" "); 
+    _out.println(record.arg, HEX); 
+    if( ++index >= AS3935_TRACE_SIZE )
+      index = 0; 
+  }
+
+  noInterrupts(); 
+  as3935TraceHead = 0; 
+  as3935TraceWrapped = false; 
+  interrupts(); 
+}
+
+#endif
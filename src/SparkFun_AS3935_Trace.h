@@ -0,0 +1,93 @@
+#ifndef _SPARKFUN_AS3935_TRACE_H_
+#define _SPARKFUN_AS3935_TRACE_H_
+
+#include <Arduino.h>
+
+// Timeline tracing of the IRQ, the 2ms register population wait, every
+// register read and write and the pipeline stages. Tracing is compiled out
+// unless AS3935_TRACE is defined, either with the line below or with a build
+// flag, in which case every trace point disappears. When it's enabled each
+// trace point stores a timestamp and two bytes into a ring of
+// AS3935_TRACE_SIZE records. as3935TraceDump() prints the ring, and
+// extras/as3935_trace_to_chrome.py turns what it prints into a Chrome trace
+// (chrome://tracing or ui.perfetto.dev).
+
+//#define AS3935_TRACE
+
+#ifndef AS3935_TRACE_SIZE
+#define AS3935_TRACE_SIZE 64
+#endif
+
+// Trace events, ORed with TRACE_BEGIN or TRACE_END for spans.
+enum SF_AS3935_TRACE_EVENTS {
+
+  TRACE_IRQ_EDGE    = 0x01, // arg: none.
+  TRACE_IRQ_WAIT,           // arg: none.
+  TRACE_READ,               // arg: first register.
+  TRACE_WRITE,              // arg: first register.
+  TRACE_STAGE,              // arg: pipeline stage index.
+  TRACE_BEGIN       = 0x40,
+  TRACE_END         = 0x80
+
+};
+
+#ifdef AS3935_TRACE
+
+typedef struct AS3935_TRACE_RECORD {
+
+  uint32_t time;  // micros()
+  uint8_t event;  // SF_AS3935_TRACE_EVENTS
+  uint8_t arg;
+
+} as3935TraceRecord;
+
+extern as3935TraceRecord as3935TraceRing[AS3935_TRACE_SIZE];
+extern volatile uint8_t as3935TraceHead;
+extern volatile bool as3935TraceWrapped;
+
+// Called from irqEdge() as well as from the sketch, so the record is taken
+// and filled with interrupts off and the head only ever holds a valid index.
+// On AVR the interrupt flag is put back as it was, rather than turned on,
+// as the caller may be an interrupt handler.
+inline void as3935Trace(uint8_t _event, uint8_t _arg)
+{
+#ifdef __AVR__
+  uint8_t sreg = SREG;
+  cli();
+#else
+  noInterrupts();
+#endif
+  uint8_t index = as3935TraceHead;
+  uint8_t next = index + 1;
+  if( next >= AS3935_TRACE_SIZE ) {
+    next = 0;
+    as3935TraceWrapped = true;
+  }
+  as3935TraceHead = next;
+  as3935TraceRecord &record = as3935TraceRing[index];
+  record.time = micros();
+  record.event = _event;
+  record.arg = _arg;
+#ifdef __AVR__
+  SREG = sreg;
+#else
+  interrupts();
+#endif
+}
+
+// Prints the ring oldest record first, one "AS3935T <time> <event> <arg>"
+// line per record in hex, and empties it.
+void as3935TraceDump(Print &_out);
+
+#define AS3935_TRACE_INSTANT(_event, _arg) as3935Trace((_event), (_arg))
+#define AS3935_TRACE_BEGIN(_event, _arg)   as3935Trace((_event) | TRACE_BEGIN, (_arg))
+#define AS3935_TRACE_END(_event, _arg)     as3935Trace((_event) | TRACE_END, (_arg))
+
+#else
+
+#define AS3935_TRACE_INSTANT(_event, _arg) ((void)0)
+#define AS3935_TRACE_BEGIN(_event, _arg)   ((void)0)
+#define AS3935_TRACE_END(_event, _arg)     ((void)0)
+
+#endif
+#endif